@@ -0,0 +1,32 @@
+/*
+ * codec.h
+ *
+ * registry of the compression formats found in archives
+ *
+ */
+
+#ifndef CODEC_H_INCLUDED
+#define CODEC_H_INCLUDED
+
+struct Codec
+{
+	const char *name; // 4-byte magic, e.g. "Yaz0"
+	
+	/* decompresses src into dst; dstSz 0 = read it from the header;
+	 * returns non-zero on failure
+	 */
+	int (*decode)(void *src, void *dst, unsigned dstSz, unsigned *srcSz);
+	
+	/* compresses src into dst, which should hold YAZ_ENCODE_BOUND(srcSz)
+	 * bytes; ctx comes from yazCtx_new(); returns non-zero on failure
+	 */
+	int (*encode)(void *src, unsigned srcSz, void *dst, unsigned *dstSz, void *ctx);
+};
+
+/* returns the codec whose magic begins 'data', or 0 if there is none */
+const struct Codec *CodecFind(const void *data);
+
+/* returns the codec named 'name' (case sensitive), or 0 */
+const struct Codec *CodecFindName(const char *name);
+
+#endif /* CODEC_H_INCLUDED */
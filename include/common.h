@@ -8,22 +8,60 @@
 #ifndef COMMON_H_INCLUDED
 #define COMMON_H_INCLUDED
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+/* a reusable buffer that grows to the largest size asked of it;
+ * zero-initialize it, and its contents are lost whenever it grows
+ */
+struct Scratch
+{
+	void *data;
+	size_t sz;
+};
+
+struct FileStamp
+{
+	int64_t mtime; // nanoseconds, where the platform has them
+	int64_t size;
+};
+
 void *FileLoad(const char *fn, size_t *sz);
 char *FileLoadAsString(const char *fn);
+const void *FileMap(const char *fn, size_t *sz);
+void FileUnmap(const void *data, size_t sz);
 bool FileIsLoaded(const char *fn, const void *data);
 char *FileGetDirectory(const char *fn);
+bool FileGetStamp(const char *fn, struct FileStamp *stamp);
+bool FileStampEqual(const struct FileStamp *a, const struct FileStamp *b);
+
+bool FileLink(const char *from, const char *to);
 
 void FilePutBE32(FILE *file, uint32_t value);
 
+/* writes to 'file' (a FILE*); for z64yar_extract_stream() */
+int FileWriteSink(void *file, const void *data, size_t sz);
+
 uint32_t U32read(const void *src);
 
+uint64_t Hash64(const void *data, size_t sz, uint64_t seed);
+
 char *Strdup(const char *str);
 char *StrdupContiguous(const char *str);
 const char *StringNextLine(const char *str);
 char *StringPrependInplace(char **srcdst, const char *prefix);
 
+struct Arena *ArenaNew(size_t blockSize);
+void *ArenaAlloc(struct Arena *arena, size_t sz);
+char *ArenaStrndup(struct Arena *arena, const char *str, size_t len);
+char *ArenaStrdup(struct Arena *arena, const char *str);
+char *ArenaStrdupContiguous(struct Arena *arena, const char *str);
+char *ArenaStrjoin(struct Arena *arena, const char *a, const char *b);
+void ArenaFree(struct Arena *arena);
+
+void *ScratchReserve(struct Scratch *scratch, size_t sz);
+void ScratchFree(struct Scratch *scratch);
+
 #endif
 
@@ -0,0 +1,64 @@
+/*
+ * image.h
+ *
+ * loading and saving 32-bit rgba images in several file formats
+ *
+ */
+
+#ifndef IMAGE_H_INCLUDED
+#define IMAGE_H_INCLUDED
+
+#include <stdbool.h>
+
+enum ImageFormat
+{
+	IMAGE_FORMAT_PNG
+	, IMAGE_FORMAT_RAW // bare rgba8888 pixels, no header
+	, IMAGE_FORMAT_PAM // netpbm P7, RGB_ALPHA
+	, IMAGE_FORMAT_BMP
+	, IMAGE_FORMAT_QOI
+};
+
+/* returns the format named 'name' ("png", "raw", ...), or -1 */
+int ImageFormatFind(const char *name);
+
+/* returns a copy of 'fn' whose extension suits 'format';
+ * png filenames are copied unchanged; free() it when done
+ */
+char *ImageFilename(const char *fn, enum ImageFormat format);
+
+/* returns rgba8888 pixels, or 0 on failure; free with ImageFree()
+ * raw images carry no dimensions, so *w and *h must be set to the
+ * expected dimensions beforehand; other formats overwrite them
+ */
+void *ImageLoad(const char *fn, enum ImageFormat format, int *w, int *h);
+void ImageFree(void *pix);
+
+/* like ImageLoad(), but gray and gray+alpha images are kept that way,
+ * with *channels set to the bytes per pixel of the result: 1 or 2 (at
+ * least minChannels; gray is given an opaque alpha channel when 2 are
+ * needed) or 4 for rgba8888; pass minChannels 4 to always get rgba
+ */
+void *ImageLoadChannels(const char *fn, enum ImageFormat format, int *w, int *h, int minChannels, int *channels);
+
+/* writes rgba8888 pixels, returns false on failure */
+bool ImageSave(const char *fn, enum ImageFormat format, int w, int h, const void *pix);
+
+/* png writer settings, shared by all threads
+ * level: 0 (stored, fastest) to 9
+ * filter: -1 picks the best filter per row, 0-4 forces one
+ */
+void ImageSetPngOptions(int level, int filter);
+
+/* zlib-style compressor used by stb_image_write (see stb.c); builds
+ * made with -DIMAGE_USE_ZLIB (and -lz) compress with zlib instead,
+ * which beats stb's default level in both speed and size at level 1
+ */
+#ifdef IMAGE_USE_ZLIB
+#define IMAGE_PNG_LEVEL_DEFAULT 1
+#else
+#define IMAGE_PNG_LEVEL_DEFAULT 8 // stb_image_write's own default
+#endif
+unsigned char *ImageDeflate(unsigned char *data, int dataLen, int *outLen, int quality);
+
+#endif /* IMAGE_H_INCLUDED */
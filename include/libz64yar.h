@@ -0,0 +1,96 @@
+/*
+ * libz64yar.h
+ *
+ * in-memory archive access, for programs embedding z64yartool
+ *
+ * nothing here touches the filesystem or exits the process; every
+ * function returns Z64YAR_OK (0) or one of the errors below, and
+ * holds no state between calls, so any number of threads may use
+ * the library at once
+ *
+ */
+
+#ifndef LIBZ64YAR_H_INCLUDED
+#define LIBZ64YAR_H_INCLUDED
+
+#include <stddef.h>
+
+#include "n64texconv.h" // for texture formats
+
+enum z64yar_error
+{
+	Z64YAR_OK = 0
+	, Z64YAR_ERR_ARGS     // invalid argument
+	, Z64YAR_ERR_NOMEM    // out of memory
+	, Z64YAR_ERR_ARCHIVE  // malformed archive
+	, Z64YAR_ERR_CODEC    // unknown codec
+	, Z64YAR_ERR_INDEX    // no such entry
+	, Z64YAR_ERR_DECODE   // malformed compressed data
+	, Z64YAR_ERR_ENCODE   // compression failed
+	, Z64YAR_ERR_CONVERT  // texture conversion failed
+	, Z64YAR_ERR_SINK     // the caller's sink failed
+	, Z64YAR_ERR_MAX
+};
+
+struct z64yar_entry
+{
+	unsigned int offset;    // of the compressed data within the archive
+	unsigned int size;      // compressed size, including alignment
+	unsigned int unyarSize; // decompressed size
+	unsigned int unyarAddr; // where it lives in an unyar'd file
+	const char *codec;      // "Yaz0", "Yay0", or "MIO0"
+};
+
+struct z64yar_texture
+{
+	const void *rgba; // RGBA8888, width * height * 4 bytes
+	int width;
+	int height;
+	enum n64texconv_fmt fmt; // color-indexed formats are unsupported
+	enum n64texconv_bpp bpp;
+};
+
+/* returns a description of an error code */
+const char *z64yar_strerror(int err);
+
+/* validates an archive and describes its entries; writes up to
+ * 'maxEntries' of them to 'entries' (which may be 0) and the total
+ * number to 'count'; a header padded out with copies of the last
+ * entry's end (as z64compress writes them) isn't counted past it
+ */
+int z64yar_stat(const void *yar, size_t yarSz, struct z64yar_entry *entries, int maxEntries, int *count);
+
+/* decompresses entry 'index' into a new buffer */
+int z64yar_extract(const void *yar, size_t yarSz, int index, void **data, size_t *dataSz);
+
+/* decompresses entry 'index' a piece at a time, handing each piece
+ * to 'sink' as it's ready; a nonzero return from 'sink' stops it; for
+ * Yaz0 entries, memory use is the same whatever the entry's size
+ */
+int z64yar_extract_stream(const void *yar, size_t yarSz, int index
+	, int (*sink)(void *udata, const void *data, size_t sz), void *udata
+);
+
+/* decompresses every entry into a new buffer, each at its unyarAddr */
+int z64yar_unyar(const void *yar, size_t yarSz, void **data, size_t *dataSz);
+
+/* decompresses entry 'index', a texture of the given format and
+ * dimensions, and converts it to a new RGBA8888 buffer
+ */
+int z64yar_dump_rgba(const void *yar, size_t yarSz, int index
+	, enum n64texconv_fmt fmt, enum n64texconv_bpp bpp, int width, int height
+	, void **rgba
+);
+
+/* converts and compresses 'count' textures into a new archive;
+ * codec 0 = "Yaz0", level 0 = YAZ_LEVEL_DEFAULT
+ */
+int z64yar_build_rgba(const struct z64yar_texture *textures, int count
+	, const char *codec, int level
+	, void **yar, size_t *yarSz
+);
+
+/* frees a buffer returned by any of the above */
+void z64yar_free(void *data);
+
+#endif /* LIBZ64YAR_H_INCLUDED */
@@ -0,0 +1,62 @@
+/*
+ * manifest.h
+ *
+ * hash manifests, written beside archives to tell when they've changed
+ *
+ */
+
+#ifndef MANIFEST_H_INCLUDED
+#define MANIFEST_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+struct ManifestEntry
+{
+	uint64_t dataHash; // of the compressed data, as stored
+	uint64_t pixHash; // of the decompressed data
+
+	// from the recipe the archive was built with; zero if it wasn't
+	int fmt;
+	int bpp;
+	int width;
+	int height;
+	struct FileStamp imageStamp; // taken before the image was read
+	char *imageFilename;
+};
+
+struct Manifest
+{
+	uint64_t archiveHash;
+	struct FileStamp archiveStamp;
+
+	// how the archive was built; recipeFilename is 0 if it wasn't
+	char *recipeFilename;
+	struct FileStamp recipeStamp;
+	int level;
+	bool fit;
+	int format; // enum ImageFormat
+
+	struct ManifestEntry *entries; // stretchy buffer
+};
+
+/* the manifest of archive 'yarName' is named 'yarName'.manifest */
+char *ManifestFilename(const char *yarName);
+
+/* loads the manifest of archive 'yarName'; returns 0 if there is
+ * none, if it's malformed, or if the archive has changed since (an
+ * archive of the same size with a new mtime is hashed to find out)
+ */
+struct Manifest *ManifestLoad(const char *yarName);
+
+/* hashes and stamps archive 'yarName', then writes its manifest;
+ * returns false on failure
+ */
+bool ManifestSave(struct Manifest *manifest, const char *yarName);
+
+void ManifestFree(struct Manifest *manifest);
+
+#endif /* MANIFEST_H_INCLUDED */
@@ -77,6 +77,35 @@ n64texconv_to_n64(
 );
 
 
+/* returns the fewest channels of gray (1) or gray and alpha (2) pixel
+ * data n64texconv_to_n64_from_gray() accepts for fmt/bpp, or 0 if
+ * fmt/bpp needs RGBA8888 (the result never outgrows the input, so
+ * in-place conversion is always safe)
+ */
+int
+n64texconv_gray_channels(
+	enum n64texconv_fmt fmt
+	, enum n64texconv_bpp bpp
+);
+
+
+/* like n64texconv_to_n64, but `pix` holds `channels` bytes per pixel:
+ * gray (1), gray and alpha (2), or RGBA8888 (4); the result is the
+ * same as expanding the pixels to RGBA8888 first, without doing so
+ */
+const char *
+n64texconv_to_n64_from_gray(
+	unsigned char *dst
+	, unsigned char *pix
+	, int channels
+	, enum n64texconv_fmt fmt
+	, enum n64texconv_bpp bpp
+	, int w
+	, int h
+	, unsigned int *sz
+);
+
+
 const char *
 n64texconv_to_n64_and_back(
 	unsigned char *pix
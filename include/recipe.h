@@ -36,12 +36,29 @@ struct Recipe
 	char *yarName;
 	char *imageDir;
 	struct RecipeItem *head;
+	struct RecipeItem *items; // contiguous; head == items
+	struct Arena *arena; // every string above lives here
+	struct RecipeStream *stream;
 	int count;
 };
 
+/* RecipeOpen() reads only the recipe's header; its items are then
+ * produced one at a time by RecipeNext(), each valid until the next
+ * call, or all at once by RecipeLoadItems(); RecipeRead() does both
+ */
+struct Recipe *RecipeOpen(const char *filename);
+struct RecipeItem *RecipeNext(struct Recipe *recipe);
+void RecipeLoadItems(struct Recipe *recipe);
 struct Recipe *RecipeRead(const char *filename);
+
+/* like RecipeRead(), but a missing or malformed recipe returns 0
+ * (after printing why) instead of exiting
+ */
+struct Recipe *RecipeLoad(const char *filename);
+
 void RecipeFree(struct Recipe *recipe);
 void RecipePrint(struct Recipe *recipe);
+int RecipeCompile(struct Recipe *recipe, const char *outfn);
 
 #endif
 
@@ -0,0 +1,25 @@
+/*
+ * scan.h
+ *
+ * 'z64yartool scan', which finds the archives inside a rom
+ *
+ */
+
+#ifndef SCAN_H_INCLUDED
+#define SCAN_H_INCLUDED
+
+/* maps the decompressed rom 'romFn' read-only and lists every archive
+ * found in it, along with each of their entries, on stdout
+ *
+ * an archive is any offset whose first word is a plausible header
+ * size, followed by an entry table that z64yar_stat() accepts
+ *
+ * if 'outDir' isn't 0, each entry is also decompressed into
+ * outDir/AAAAAAAA/xxxxxxxx.bin, where AAAAAAAA is the archive's rom
+ * offset and xxxxxxxx is where the entry lives in an unyar'd file
+ * (the names 'stat' gives its images); searching and decompressing
+ * are spread across 'threads' threads
+ */
+int Scan(const char *romFn, const char *outDir, int threads);
+
+#endif /* SCAN_H_INCLUDED */
@@ -0,0 +1,41 @@
+/*
+ * serve.h
+ *
+ * 'z64yartool serve', which keeps its work warm between requests
+ *
+ */
+
+#ifndef SERVE_H_INCLUDED
+#define SERVE_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "image.h"
+
+/* listens on a unix domain socket at 'socketPath' and answers one
+ * request per connection; a request is a single line, one of
+ *   build recipe.txt [--level n|max] [--format name]
+ *   dump recipe.txt [--format name]
+ *   extract archive.yar index output.bin
+ *   quit
+ * and its answer is everything the request printed, followed by a
+ * last line reading "ok" or "error"; relative paths are relative to
+ * the directory the server was started in
+ *
+ * parsed recipes, archive indices, and the compressed data of every
+ * image built are cached, and used for as long as the files they came
+ * from keep the same modification time and size
+ *
+ * returns once a quit request has been answered
+ */
+int Serve(const char *socketPath, int threads);
+
+/* the caches and worker threads behind Serve(), for use without a
+ * socket; ServerBuild() works like the build request, printing what
+ * it does to stderr, and returns false on failure
+ */
+struct Server *ServerNew(int threads);
+bool ServerBuild(struct Server *server, const char *recipeFn, int level, enum ImageFormat format);
+void ServerFree(struct Server *server);
+
+#endif /* SERVE_H_INCLUDED */
@@ -0,0 +1,38 @@
+/*
+ * store.h
+ *
+ * content-addressed store, so identical textures are handled once
+ *
+ */
+
+#ifndef STORE_H_INCLUDED
+#define STORE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* payloads are keyed by their bytes, and by a 'tag' telling apart
+ * equal bytes that mean different things (such as the same pixels
+ * in different texture formats); any number of threads may share one
+ */
+struct Store *StoreNew(void);
+void StoreFree(struct Store *store);
+
+/* finds the entry for a payload, adding it if there is none; when
+ * *isNew is set, the caller is the first to ask for it, and must
+ * StorePublish() the result of its work for the others to StoreWait()
+ * on, so work on each unique payload is done once
+ */
+struct StoreEntry *StoreClaim(struct Store *store, const void *data, size_t sz, uint64_t tag, bool *isNew);
+
+/* copies 'value' into the entry and wakes anyone waiting for it */
+void StorePublish(struct StoreEntry *entry, const void *value, size_t valueSz);
+
+/* blocks until the entry's value is published, then returns it */
+const void *StoreWait(struct StoreEntry *entry, size_t *valueSz);
+
+/* how many payloads were claimed, and how many of them were unique */
+void StoreGetCounts(struct Store *store, int *claimed, int *unique);
+
+#endif /* STORE_H_INCLUDED */
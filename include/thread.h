@@ -0,0 +1,43 @@
+/*
+ * thread.h
+ *
+ * threading helpers
+ *
+ */
+
+#ifndef THREAD_H_INCLUDED
+#define THREAD_H_INCLUDED
+
+#include <stdbool.h>
+
+/* bounded blocking queue
+ * QueuePush() blocks while the queue is full
+ * QueuePop() blocks while the queue is empty, and returns 0 once
+ *            the queue has been closed and drained
+ */
+struct Queue *QueueNew(int depth);
+void QueuePush(struct Queue *queue, void *item);
+void *QueuePop(struct Queue *queue);
+void QueueClose(struct Queue *queue);
+void QueueFree(struct Queue *queue);
+
+/* one-shot event, EventWait() blocks until EventSet() has been called */
+struct Event *EventNew(void);
+void EventSet(struct Event *event);
+void EventWait(struct Event *event);
+void EventFree(struct Event *event);
+
+/* mutual exclusion lock */
+struct Mutex *MutexNew(void);
+void MutexLock(struct Mutex *mutex);
+void MutexUnlock(struct Mutex *mutex);
+void MutexFree(struct Mutex *mutex);
+
+/* runs func(udata) on a new thread, returns 0 on failure */
+struct Thread *ThreadNew(void *func(void *udata), void *udata);
+void ThreadJoin(struct Thread *thread);
+
+/* number of processors available */
+int ThreadCpuCount(void);
+
+#endif
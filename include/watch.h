@@ -0,0 +1,28 @@
+/*
+ * watch.h
+ *
+ * 'z64yartool watch', which rebuilds a recipe as its images are saved
+ *
+ */
+
+#ifndef WATCH_H_INCLUDED
+#define WATCH_H_INCLUDED
+
+#include "image.h"
+
+/* rebuilds the archive 'recipeFn' describes whenever the recipe or
+ * one of its images is saved, after a burst of saves has settled
+ *
+ * archives are rebuilt with ServerBuild(), which only compresses the
+ * images that changed; retexture recipes are handed to retexture(),
+ * along with the images that changed (or 0 if the recipe itself did),
+ * in a child process so that a failed rebuild can't end the watch
+ *
+ * runs until the process is stopped, or returns on failure to start
+ */
+int Watch(const char *recipeFn, int threads, int level, enum ImageFormat format
+	, int retexture(const char *recipeFn, char **changed, int changedCount, void *udata)
+	, void *udata
+);
+
+#endif /* WATCH_H_INCLUDED */
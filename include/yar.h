@@ -35,7 +35,8 @@ yar_reencode(
 	, int exist(void *src, unsigned srcSz, void *dst, unsigned *dstSz)
 );
 
-int unyar(const char *infn, const char *outfn, int isHeaderless);
+/* threads > 1 decodes the files in parallel, with the same result */
+int unyar(const char *infn, const char *outfn, int isHeaderless, int threads);
 
 int spinout_yaz_dec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz);
 
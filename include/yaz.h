@@ -3,10 +3,69 @@
 #ifndef YAZ_H_INCLUDED
 #define YAZ_H_INCLUDED
 
+/* largest possible encoded size for an input of SZ bytes */
+#define YAZ_ENCODE_BOUND(SZ) ((SZ) + ((SZ) + 7) / 8 + 0x20)
+
+/* compression levels
+ * YAZ_LEVEL_DEFAULT matches z64compress byte for byte
+ * YAZ_LEVEL_MAX finds the smallest possible encoding (much slower)
+ */
+#define YAZ_LEVEL_DEFAULT 1
+#define YAZ_LEVEL_MAX     2
+
+/* inputs at least this large have their matches searched in parallel */
+#define YAZ_PARALLEL_MIN (64 * 1024)
+
 int yazenc(void *src, unsigned src_sz, void *dst, unsigned *dst_sz, void *_ctx);
 void *yazCtx_new(void);
 void yazCtx_free(void *_ctx);
+void yazCtx_set_threads(void *_ctx, int threads);
+void yazCtx_set_level(void *_ctx, int level);
 int yazdec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz);
 
+/* Yay0 and MIO0 share the Yaz0 encoder and its context; decoders
+ * read the decompressed size from the header when dstSz is 0
+ */
+int yayenc(void *src, unsigned src_sz, void *dst, unsigned *dst_sz, void *_ctx);
+int mioenc(void *src, unsigned src_sz, void *dst, unsigned *dst_sz, void *_ctx);
+int yaydec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz);
+int miodec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz);
+
+/* streaming Yaz0 decoder, for data that arrives or leaves in pieces;
+ * it keeps only the 4 KiB window back-references can reach, so its
+ * memory use doesn't depend on the size of the data
+ */
+#define YAZ_STREAM_OK     0  /* needs more input, or more room for output */
+#define YAZ_STREAM_END    1  /* everything has been decoded */
+#define YAZ_STREAM_ERROR -1  /* malformed data */
+
+void *yazStream_new(void);
+void yazStream_free(void *_stream);
+
+/* decodes as much of src as fits in dst, and reports how many bytes of
+ * each were used; call again with the rest of src (or the next piece
+ * of it) and more room in dst until it returns YAZ_STREAM_END
+ */
+int yazStream_dec(void *_stream, const void *_src, unsigned srcSz, unsigned *srcUsed, void *_dst, unsigned dstSz, unsigned *dstUsed);
+
+/* the decompressed size, once the header has been read (otherwise 0) */
+unsigned yazStream_size(void *_stream);
+
+/* streaming Yaz0 encoder, the counterpart of the above; it produces
+ * exactly what yazenc() does at YAZ_LEVEL_DEFAULT, but keeps only the
+ * 4 KiB window and a little lookahead, and writes each group of eight
+ * commands as soon as it is final; the header stores the decompressed
+ * size, so that must be known from the start
+ */
+void *yazEncStream_new(unsigned srcSz);
+void yazEncStream_free(void *_stream);
+
+/* takes in as much of src, and writes out as much encoded data to dst,
+ * as it can; call again with the rest of src (or the next piece of it)
+ * and more room in dst until it returns YAZ_STREAM_END, which it does
+ * once all srcSz bytes have been given and everything has been written
+ */
+int yazEncStream_enc(void *_stream, const void *_src, unsigned srcSz, unsigned *srcUsed, void *_dst, unsigned dstSz, unsigned *dstUsed);
+
 #endif /* YAZ_H_INCLUDED */
 
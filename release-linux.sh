@@ -1,3 +1,10 @@
 mkdir -p bin/
-gcc -o bin/z64yartool -Os -s -flto -DNDEBUG -Wall -Wextra -Wno-unused-function -std=c99 -pedantic -Iinclude -Iexoquant src/*.c  exoquant/*.c -lm
+gcc -o bin/z64yartool -Os -s -flto -DNDEBUG -Wall -Wextra -Wno-unused-function -std=c99 -pedantic -Iinclude -Iexoquant src/*.c  exoquant/*.c -lm -pthread
 
+# libz64yar, for programs that embed archive handling
+LIBSRC="src/libz64yar.c src/yaz.c src/codec.c src/n64texconv.c src/common.c src/thread.c"
+gcc -o bin/libz64yar.so -shared -fPIC -Os -s -DNDEBUG -Wall -Wextra -Wno-unused-function -std=c99 -pedantic -Iinclude $LIBSRC -lm -pthread
+mkdir -p bin/libz64yar/
+(cd bin/libz64yar/ && gcc -c -Os -DNDEBUG -Wall -Wextra -Wno-unused-function -std=c99 -pedantic -I../../include $(printf '../../%s ' $LIBSRC))
+ar rcs bin/libz64yar.a bin/libz64yar/*.o
+rm -r bin/libz64yar/
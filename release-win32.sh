@@ -1,3 +1,3 @@
 mkdir -p bin/
-i686-w64-mingw32.static-gcc -o bin/z64yartool.exe -Os -s -flto -DNDEBUG -Wall -Wextra -Wno-unused-function -std=c99 -pedantic -Iinclude -Iexoquant src/*.c  exoquant/*.c -lm
+i686-w64-mingw32.static-gcc -o bin/z64yartool.exe -Os -s -flto -DNDEBUG -Wall -Wextra -Wno-unused-function -std=c99 -pedantic -Iinclude -Iexoquant src/*.c  exoquant/*.c -lm -pthread
 
@@ -0,0 +1,37 @@
+/*
+ * codec.c
+ *
+ * registry of the compression formats found in archives
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+#include "yaz.h"
+
+static const struct Codec sCodecs[] =
+{
+	{ "Yaz0", yazdec, yazenc }
+	, { "Yay0", yaydec, yayenc }
+	, { "MIO0", miodec, mioenc }
+};
+
+const struct Codec *CodecFind(const void *data)
+{
+	for (size_t i = 0; i < sizeof(sCodecs) / sizeof(*sCodecs); ++i)
+		if (!memcmp(data, sCodecs[i].name, 4))
+			return &sCodecs[i];
+	
+	return 0;
+}
+
+const struct Codec *CodecFindName(const char *name)
+{
+	for (size_t i = 0; i < sizeof(sCodecs) / sizeof(*sCodecs); ++i)
+		if (!strcmp(name, sCodecs[i].name))
+			return &sCodecs[i];
+	
+	return 0;
+}
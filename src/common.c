@@ -5,11 +5,23 @@
  *
  */
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L // st_mtim
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h> // file mapping
+#else
+#include <windows.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+#include <sys/stat.h> // modification times
+#include <sys/types.h>
+
 #include "common.h"
 
 /* minimal file loader
@@ -51,6 +63,63 @@ char *FileLoadAsString(const char *fn)
 	return dst;
 }
 
+/* maps a file read-only, for inputs too big to copy
+ * returns 0 on failure
+ */
+const void *FileMap(const char *fn, size_t *sz)
+{
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+	LARGE_INTEGER size;
+	void *dat = 0;
+	
+	if ((file = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0)) == INVALID_HANDLE_VALUE)
+		return 0;
+	
+	if (GetFileSizeEx(file, &size) && size.QuadPart
+		&& (mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0))
+	)
+	{
+		dat = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		*sz = size.QuadPart;
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	
+	return dat;
+#else
+	struct stat st;
+	void *dat;
+	int fd;
+	
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return 0;
+	
+	if (fstat(fd, &st) || !st.st_size
+		|| (dat = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED
+	)
+	{
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	*sz = st.st_size;
+	
+	return dat;
+#endif
+}
+
+void FileUnmap(const void *data, size_t sz)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	(void)sz;
+#else
+	munmap((void*)data, sz);
+#endif
+}
+
 bool FileIsLoaded(const char *fn, const void *data)
 {
 	if (!data)
@@ -62,6 +131,70 @@ bool FileIsLoaded(const char *fn, const void *data)
 	return true;
 }
 
+bool FileGetStamp(const char *fn, struct FileStamp *stamp)
+{
+	struct stat st;
+	
+	if (stat(fn, &st))
+		return false;
+	
+#ifdef _WIN32
+	stamp->mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+	stamp->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	stamp->size = st.st_size;
+	
+	return true;
+}
+
+bool FileStampEqual(const struct FileStamp *a, const struct FileStamp *b)
+{
+	return a->mtime == b->mtime && a->size == b->size;
+}
+
+/* makes 'to' a hard link to 'from', or a copy of it where links
+ * aren't possible (across drives, for example)
+ * returns false on failure
+ */
+bool FileLink(const char *from, const char *to)
+{
+	void *dat;
+	size_t sz;
+	FILE *fp;
+	bool ok;
+#ifndef _WIN32
+	struct stat a;
+	struct stat b;
+	
+	// already the same file, so removing 'to' would lose it
+	if (!stat(from, &a) && !stat(to, &b) && a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+		return true;
+#endif
+	
+	if (!strcmp(from, to))
+		return true;
+	
+	remove(to);
+#ifdef _WIN32
+	if (CreateHardLinkA(to, from, 0))
+		return true;
+#else
+	if (!link(from, to))
+		return true;
+#endif
+	
+	if (!(dat = FileLoad(from, &sz)))
+		return false;
+	
+	ok = (fp = fopen(to, "wb")) && fwrite(dat, 1, sz, fp) == sz;
+	if (fp && fclose(fp))
+		ok = false;
+	free(dat);
+	
+	return ok;
+}
+
 void FilePutBE32(FILE *file, uint32_t value)
 {
 	fputc(value >> 24, file);
@@ -70,6 +203,11 @@ void FilePutBE32(FILE *file, uint32_t value)
 	fputc(value >>  0, file);
 }
 
+int FileWriteSink(void *file, const void *data, size_t sz)
+{
+	return fwrite(data, 1, sz, file) != sz;
+}
+
 char *FileGetDirectory(const char *fn)
 {
 	char *out = Strdup(fn);
@@ -90,7 +228,99 @@ uint32_t U32read(const void *src)
 {
 	const uint8_t *b = src;
 	
-	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | (b[3]);
+	return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | (b[3]);
+}
+
+/* xxHash's XXH64, for telling apart large buffers quickly;
+ * gives the same result on every platform
+ */
+#define HASH64_P1 0x9E3779B185EBCA87ull
+#define HASH64_P2 0xC2B2AE3D27D4EB4Full
+#define HASH64_P3 0x165667B19E3779F9ull
+#define HASH64_P4 0x85EBCA77C2B2AE63ull
+#define HASH64_P5 0x27D4EB2F165667C5ull
+#define HASH64_ROTL(X, N) (((X) << (N)) | ((X) >> (64 - (N))))
+
+static uint64_t Hash64Read64(const uint8_t *b)
+{
+	return (uint64_t)b[0] | ((uint64_t)b[1] << 8) | ((uint64_t)b[2] << 16) | ((uint64_t)b[3] << 24)
+		| ((uint64_t)b[4] << 32) | ((uint64_t)b[5] << 40) | ((uint64_t)b[6] << 48) | ((uint64_t)b[7] << 56);
+}
+
+static uint64_t Hash64Round(uint64_t acc, uint64_t input)
+{
+	acc += input * HASH64_P2;
+	acc = HASH64_ROTL(acc, 31);
+	
+	return acc * HASH64_P1;
+}
+
+static uint64_t Hash64Merge(uint64_t acc, uint64_t lane)
+{
+	acc ^= Hash64Round(0, lane);
+	
+	return acc * HASH64_P1 + HASH64_P4;
+}
+
+uint64_t Hash64(const void *data, size_t sz, uint64_t seed)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = p + sz;
+	uint64_t h;
+	
+	if (sz >= 32)
+	{
+		uint64_t v1 = seed + HASH64_P1 + HASH64_P2;
+		uint64_t v2 = seed + HASH64_P2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - HASH64_P1;
+		
+		// four independent lanes, 32 bytes at a time
+		for (; p + 32 <= end; p += 32)
+		{
+			v1 = Hash64Round(v1, Hash64Read64(p));
+			v2 = Hash64Round(v2, Hash64Read64(p + 8));
+			v3 = Hash64Round(v3, Hash64Read64(p + 16));
+			v4 = Hash64Round(v4, Hash64Read64(p + 24));
+		}
+		
+		h = HASH64_ROTL(v1, 1) + HASH64_ROTL(v2, 7) + HASH64_ROTL(v3, 12) + HASH64_ROTL(v4, 18);
+		h = Hash64Merge(h, v1);
+		h = Hash64Merge(h, v2);
+		h = Hash64Merge(h, v3);
+		h = Hash64Merge(h, v4);
+	}
+	else
+		h = seed + HASH64_P5;
+	
+	h += sz;
+	
+	// the remainder
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= Hash64Round(0, Hash64Read64(p));
+		h = HASH64_ROTL(h, 27) * HASH64_P1 + HASH64_P4;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= ((uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)) * HASH64_P1;
+		h = HASH64_ROTL(h, 23) * HASH64_P2 + HASH64_P3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+	{
+		h ^= *p * HASH64_P5;
+		h = HASH64_ROTL(h, 11) * HASH64_P1;
+	}
+	
+	// avalanche
+	h ^= h >> 33;
+	h *= HASH64_P2;
+	h ^= h >> 29;
+	h *= HASH64_P3;
+	h ^= h >> 32;
+	
+	return h;
 }
 
 char *Strdup(const char *str)
@@ -138,4 +368,132 @@ const char *StringNextLine(const char *str)
 	return str;
 }
 
+/* string arena
+ * allocations are carved out of large blocks, and released
+ * all at once by ArenaFree(); pointers remain valid until then
+ */
+struct ArenaBlock
+{
+	struct ArenaBlock *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+struct Arena
+{
+	struct ArenaBlock *head;
+	size_t blockSize;
+};
+
+struct Arena *ArenaNew(size_t blockSize)
+{
+	struct Arena *arena = calloc(1, sizeof(*arena));
+	
+	assert(arena);
+	
+	arena->blockSize = blockSize ? blockSize : 4096;
+	
+	return arena;
+}
+
+void *ArenaAlloc(struct Arena *arena, size_t sz)
+{
+	struct ArenaBlock *block = arena->head;
+	void *result;
+	
+	/* keep every allocation pointer-aligned */
+	sz = (sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	
+	if (!block || block->used + sz > block->size)
+	{
+		size_t size = arena->blockSize;
+		
+		if (size < sz)
+			size = sz;
+		
+		block = malloc(sizeof(*block) + size);
+		assert(block);
+		block->next = arena->head;
+		block->used = 0;
+		block->size = size;
+		arena->head = block;
+	}
+	
+	result = block->data + block->used;
+	block->used += sz;
+	
+	return result;
+}
+
+char *ArenaStrndup(struct Arena *arena, const char *str, size_t len)
+{
+	char *dst = ArenaAlloc(arena, len + 1);
+	
+	memcpy(dst, str, len);
+	dst[len] = '\0';
+	
+	return dst;
+}
+
+char *ArenaStrdup(struct Arena *arena, const char *str)
+{
+	return ArenaStrndup(arena, str, strlen(str));
+}
+
+char *ArenaStrdupContiguous(struct Arena *arena, const char *str)
+{
+	return ArenaStrndup(arena, str, strcspn(str, " \r\n\t"));
+}
+
+char *ArenaStrjoin(struct Arena *arena, const char *a, const char *b)
+{
+	size_t aLen = strlen(a);
+	size_t bLen = strlen(b);
+	char *dst = ArenaAlloc(arena, aLen + bLen + 1);
+	
+	memcpy(dst, a, aLen);
+	memcpy(dst + aLen, b, bLen + 1);
+	
+	return dst;
+}
 
+void ArenaFree(struct Arena *arena)
+{
+	struct ArenaBlock *next;
+	
+	if (!arena)
+		return;
+	
+	for (struct ArenaBlock *this = arena->head; this; this = next)
+	{
+		next = this->next;
+		free(this);
+	}
+	
+	free(arena);
+}
+
+void *ScratchReserve(struct Scratch *scratch, size_t sz)
+{
+	if (sz > scratch->sz)
+	{
+		// contents needn't survive, so don't pay for realloc's copy
+		free(scratch->data);
+		if (!(scratch->data = malloc(sz)))
+		{
+			fprintf(stderr, "failed to allocate %lu bytes\n", (unsigned long)sz);
+			exit(EXIT_FAILURE);
+		}
+		scratch->sz = sz;
+	}
+	
+	return scratch->data;
+}
+
+void ScratchFree(struct Scratch *scratch)
+{
+	free(scratch->data);
+	scratch->data = 0;
+	scratch->sz = 0;
+}
@@ -0,0 +1,563 @@
+/*
+ * image.c
+ *
+ * loading and saving 32-bit rgba images in several file formats
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "common.h"
+#include "image.h"
+#include "stb_image_write.h"
+#include "stb_image.h"
+
+#ifdef IMAGE_USE_ZLIB
+#include <zlib.h>
+#else
+unsigned char *StbDeflate(unsigned char *data, int dataLen, int *outLen, int quality);
+#endif
+
+static const char *sExtensions[] = { "png", "raw", "pam", "bmp", "qoi" };
+
+/* qoi, see https://qoiformat.org/qoi-specification.pdf */
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_HASH(PX) (((PX)[0] * 3 + (PX)[1] * 5 + (PX)[2] * 7 + (PX)[3] * 11) & 63)
+#define QOI_HEADER_SZ 14
+#define QOI_PADDING_SZ 8
+
+static int imax(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+static void PutBE32(uint8_t *dst, uint32_t v)
+{
+	dst[0] = v >> 24;
+	dst[1] = v >> 16;
+	dst[2] = v >> 8;
+	dst[3] = v;
+}
+
+static void PutLE(uint8_t *dst, uint32_t v, int bytes)
+{
+	while (bytes--)
+	{
+		*dst++ = v;
+		v >>= 8;
+	}
+}
+
+/* 32-bit bottom-up bmp; a v4 header with explicit channel masks is
+ * used so readers (stb_image included) keep the alpha channel as is
+ */
+#define BMP_HEADER_SZ (14 + 108)
+static uint8_t *BmpEncode(const uint8_t *pix, int w, int h, size_t *sz)
+{
+	size_t pixSz = (size_t)w * h * 4;
+	uint8_t *out = calloc(1, BMP_HEADER_SZ + pixSz);
+	uint8_t *o;
+	
+	if (!out)
+		return 0;
+	
+	// file header
+	memcpy(out, "BM", 2);
+	PutLE(out + 2, BMP_HEADER_SZ + pixSz, 4);
+	PutLE(out + 10, BMP_HEADER_SZ, 4);
+	
+	// BITMAPV4HEADER
+	o = out + 14;
+	PutLE(o + 0, 108, 4);
+	PutLE(o + 4, w, 4);
+	PutLE(o + 8, h, 4);
+	PutLE(o + 12, 1, 2); // planes
+	PutLE(o + 14, 32, 2); // bpp
+	PutLE(o + 16, 3, 4); // BI_BITFIELDS
+	PutLE(o + 20, pixSz, 4);
+	PutLE(o + 24, 2835, 4); // 72 dpi
+	PutLE(o + 28, 2835, 4);
+	PutLE(o + 40, 0x00ff0000, 4); // masks
+	PutLE(o + 44, 0x0000ff00, 4);
+	PutLE(o + 48, 0x000000ff, 4);
+	PutLE(o + 52, 0xff000000, 4);
+	memcpy(o + 56, "BGRs", 4); // LCS_sRGB
+	
+	// bgra pixels, last row first
+	o = out + BMP_HEADER_SZ;
+	for (int y = h - 1; y >= 0; --y)
+	{
+		const uint8_t *row = pix + (size_t)y * w * 4;
+		
+		for (int x = 0; x < w; ++x, o += 4, row += 4)
+		{
+			o[0] = row[2];
+			o[1] = row[1];
+			o[2] = row[0];
+			o[3] = row[3];
+		}
+	}
+	
+	*sz = BMP_HEADER_SZ + pixSz;
+	return out;
+}
+
+static uint8_t *QoiEncode(const uint8_t *pix, int w, int h, size_t *sz)
+{
+	size_t count = (size_t)w * h;
+	uint8_t *out = malloc(QOI_HEADER_SZ + count * 5 + QOI_PADDING_SZ);
+	uint8_t *o = out;
+	uint8_t index[64][4] = {{0}};
+	uint8_t prev[4] = { 0, 0, 0, 255 };
+	int run = 0;
+	
+	if (!out)
+		return 0;
+	
+	memcpy(o, "qoif", 4);
+	PutBE32(o + 4, w);
+	PutBE32(o + 8, h);
+	o[12] = 4; // channels
+	o[13] = 0; // srgb with linear alpha
+	o += QOI_HEADER_SZ;
+	
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint8_t *px = pix + i * 4;
+		
+		if (!memcmp(px, prev, 4))
+		{
+			if (++run == 62 || i == count - 1)
+			{
+				*o++ = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+			continue;
+		}
+		
+		if (run)
+		{
+			*o++ = QOI_OP_RUN | (run - 1);
+			run = 0;
+		}
+		
+		int hash = QOI_HASH(px);
+		if (!memcmp(index[hash], px, 4))
+			*o++ = QOI_OP_INDEX | hash;
+		else
+		{
+			memcpy(index[hash], px, 4);
+			
+			if (px[3] == prev[3])
+			{
+				int8_t vr = px[0] - prev[0];
+				int8_t vg = px[1] - prev[1];
+				int8_t vb = px[2] - prev[2];
+				int8_t vgr = vr - vg;
+				int8_t vgb = vb - vg;
+				
+				if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+					*o++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+				else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+				{
+					*o++ = QOI_OP_LUMA | (vg + 32);
+					*o++ = (vgr + 8) << 4 | (vgb + 8);
+				}
+				else
+				{
+					*o++ = QOI_OP_RGB;
+					memcpy(o, px, 3);
+					o += 3;
+				}
+			}
+			else
+			{
+				*o++ = QOI_OP_RGBA;
+				memcpy(o, px, 4);
+				o += 4;
+			}
+		}
+		memcpy(prev, px, 4);
+	}
+	
+	memset(o, 0, QOI_PADDING_SZ - 1);
+	o[QOI_PADDING_SZ - 1] = 1;
+	o += QOI_PADDING_SZ;
+	
+	*sz = o - out;
+	return out;
+}
+
+static uint8_t *QoiDecode(const uint8_t *data, size_t sz, int *w, int *h)
+{
+	const uint8_t *end = data + sz - QOI_PADDING_SZ;
+	const uint8_t *d = data + QOI_HEADER_SZ;
+	uint8_t index[64][4] = {{0}};
+	uint8_t px[4] = { 0, 0, 0, 255 };
+	uint8_t *pix;
+	size_t count;
+	int run = 0;
+	
+	if (sz < QOI_HEADER_SZ + QOI_PADDING_SZ || memcmp(data, "qoif", 4))
+		return 0;
+	
+	*w = U32read(data + 4);
+	*h = U32read(data + 8);
+	if (*w <= 0 || *h <= 0 || (size_t)*w * *h > 0x4000000)
+		return 0;
+	count = (size_t)*w * *h;
+	if (!(pix = malloc(count * 4)))
+		return 0;
+	
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (run)
+			run -= 1;
+		else if (d < end)
+		{
+			int op = *d++;
+			
+			if (op == QOI_OP_RGB)
+			{
+				memcpy(px, d, 3);
+				d += 3;
+			}
+			else if (op == QOI_OP_RGBA)
+			{
+				memcpy(px, d, 4);
+				d += 4;
+			}
+			else if ((op & 0xc0) == QOI_OP_INDEX)
+				memcpy(px, index[op], 4);
+			else if ((op & 0xc0) == QOI_OP_DIFF)
+			{
+				px[0] += ((op >> 4) & 3) - 2;
+				px[1] += ((op >> 2) & 3) - 2;
+				px[2] += (op & 3) - 2;
+			}
+			else if ((op & 0xc0) == QOI_OP_LUMA)
+			{
+				int vg = (op & 0x3f) - 32;
+				
+				px[0] += vg - 8 + ((*d >> 4) & 15);
+				px[1] += vg;
+				px[2] += vg - 8 + (*d & 15);
+				d += 1;
+			}
+			else // QOI_OP_RUN
+				run = op & 0x3f;
+			
+			memcpy(index[QOI_HASH(px)], px, 4);
+		}
+		memcpy(pix + i * 4, px, 4);
+	}
+	
+	return pix;
+}
+
+/* netpbm pam; only 8-bit depths 1-4 (gray, gray+alpha, rgb, rgba) */
+static uint8_t *PamDecode(const uint8_t *data, size_t sz, int *w, int *h)
+{
+	const char *str = (const char*)data;
+	const char *end = str + sz;
+	long width = 0;
+	long height = 0;
+	long depth = 0;
+	long maxval = 0;
+	uint8_t *pix;
+	size_t count;
+	
+	if (sz < 3 || memcmp(str, "P7\n", 3))
+		return 0;
+	str += 3;
+	
+	// header is one token and value per line, ended by ENDHDR
+	while (str < end)
+	{
+		const char *line = str;
+		const char *value;
+		
+		while (str < end && *str != '\n')
+			++str;
+		if (str == end)
+			return 0;
+		++str;
+		
+		if (*line == '#')
+			continue;
+		if (!strncmp(line, "ENDHDR", 6))
+			break;
+		for (value = line; value < str && !isspace((unsigned char)*value); ++value)
+			;
+		
+#define PAM_FIELD(NAME, DST) \
+	if (!strncmp(line, NAME, value - line) && (size_t)(value - line) == strlen(NAME)) \
+		DST = strtol(value, 0, 10);
+		PAM_FIELD("WIDTH", width)
+		PAM_FIELD("HEIGHT", height)
+		PAM_FIELD("DEPTH", depth)
+		PAM_FIELD("MAXVAL", maxval)
+#undef PAM_FIELD
+	}
+	
+	if (width <= 0 || height <= 0 || depth < 1 || depth > 4 || maxval != 255
+		|| width * height > 0x4000000
+	)
+		return 0;
+	count = (size_t)width * height;
+	if ((size_t)(end - str) < count * depth || !(pix = malloc(count * 4)))
+		return 0;
+	
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint8_t *src = (const uint8_t*)str + i * depth;
+		uint8_t *dst = pix + i * 4;
+		
+		switch (depth)
+		{
+			case 1: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+			case 2: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break;
+			case 3: memcpy(dst, src, 3); dst[3] = 255; break;
+			case 4: memcpy(dst, src, 4); break;
+		}
+	}
+	
+	*w = width;
+	*h = height;
+	return pix;
+}
+
+/* zlib stream made of stored (uncompressed) blocks */
+static unsigned char *DeflateStored(const unsigned char *data, int dataLen, int *outLen)
+{
+	int blocks = dataLen / 0xffff + 1;
+	unsigned char *out = malloc(2 + blocks * 5 + dataLen + 4);
+	unsigned char *o = out;
+	uint32_t s1 = 1;
+	uint32_t s2 = 0;
+	
+	if (!out)
+		return 0;
+	
+	*o++ = 0x78; // 32k window
+	*o++ = 0x01; // fastest
+	for (int i = 0; i < blocks; ++i)
+	{
+		int len = dataLen - i * 0xffff;
+		
+		if (len > 0xffff)
+			len = 0xffff;
+		*o++ = i == blocks - 1; // BFINAL, BTYPE = 0
+		PutLE(o, len, 2);
+		PutLE(o + 2, ~len, 2);
+		memcpy(o + 4, data + i * 0xffff, len);
+		o += 4 + len;
+	}
+	
+	// adler32, reduced often enough that it can't overflow
+	for (int i = 0; i < dataLen; )
+	{
+		int end = i + 5552 < dataLen ? i + 5552 : dataLen;
+		
+		for (; i < end; ++i)
+		{
+			s1 += data[i];
+			s2 += s1;
+		}
+		s1 %= 65521;
+		s2 %= 65521;
+	}
+	PutBE32(o, s2 << 16 | s1);
+	o += 4;
+	
+	*outLen = o - out;
+	return out;
+}
+
+void ImageSetPngOptions(int level, int filter)
+{
+	stbi_write_png_compression_level = level;
+	stbi_write_force_png_filter = filter;
+}
+
+unsigned char *ImageDeflate(unsigned char *data, int dataLen, int *outLen, int quality)
+{
+	if (quality <= 0)
+		return DeflateStored(data, dataLen, outLen);
+	
+#ifdef IMAGE_USE_ZLIB
+	uLongf sz = compressBound(dataLen);
+	unsigned char *out = malloc(sz);
+	
+	if (!out || compress2(out, &sz, data, dataLen, quality > 9 ? 9 : quality) != Z_OK)
+	{
+		free(out);
+		return 0;
+	}
+	*outLen = sz;
+	
+	return out;
+#else
+	return StbDeflate(data, dataLen, outLen, quality);
+#endif
+}
+
+int ImageFormatFind(const char *name)
+{
+	for (int i = 0; i < (int)(sizeof(sExtensions) / sizeof(*sExtensions)); ++i)
+		if (!strcmp(name, sExtensions[i]))
+			return i;
+	
+	return -1;
+}
+
+char *ImageFilename(const char *fn, enum ImageFormat format)
+{
+	const char *slash = strrchr(fn, '/');
+	const char *period = strrchr(fn, '.');
+	size_t stemLen = strlen(fn);
+	char *result;
+	
+	if (format == IMAGE_FORMAT_PNG)
+		return Strdup(fn);
+	
+	if (period && (!slash || period > slash))
+		stemLen = period - fn;
+	
+	result = malloc(stemLen + 5);
+	if (!result)
+		return 0;
+	memcpy(result, fn, stemLen);
+	result[stemLen] = '.';
+	strcpy(result + stemLen + 1, sExtensions[format]);
+	
+	return result;
+}
+
+void *ImageLoad(const char *fn, enum ImageFormat format, int *w, int *h)
+{
+	uint8_t *data;
+	void *pix = 0;
+	size_t sz;
+	int unused;
+	
+	if (format == IMAGE_FORMAT_PNG || format == IMAGE_FORMAT_BMP)
+		return stbi_load(fn, w, h, &unused, STBI_rgb_alpha);
+	
+	if (!(data = FileLoad(fn, &sz)))
+		return 0;
+	
+	switch (format)
+	{
+		case IMAGE_FORMAT_RAW:
+			if (*w > 0 && *h > 0 && sz == (size_t)*w * *h * 4)
+			{
+				pix = data;
+				data = 0;
+			}
+			break;
+		
+		case IMAGE_FORMAT_PAM:
+			pix = PamDecode(data, sz, w, h);
+			break;
+		
+		case IMAGE_FORMAT_QOI:
+			pix = QoiDecode(data, sz, w, h);
+			break;
+		
+		default:
+			break;
+	}
+	
+	free(data);
+	return pix;
+}
+
+// expands 'count' pixels to 'to' channels the way stb_image would
+static uint8_t *ImageExpand(uint8_t *pix, size_t count, int from, int to)
+{
+	uint8_t *out = malloc(count * to);
+	
+	if (!out)
+		return 0;
+	
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint8_t *src = pix + i * from;
+		uint8_t *dst = out + i * to;
+		
+		if (from <= 2)
+			memset(dst, src[0], to == 2 ? 1 : 3);
+		else
+			memcpy(dst, src, 3);
+		dst[to - 1] = (from == 2 || from == 4) ? src[from - 1] : 255;
+	}
+	
+	free(pix);
+	return out;
+}
+
+void *ImageLoadChannels(const char *fn, enum ImageFormat format, int *w, int *h, int minChannels, int *channels)
+{
+	uint8_t *pix;
+	int comp;
+	
+	*channels = 4;
+	if (format != IMAGE_FORMAT_PNG && format != IMAGE_FORMAT_BMP)
+		return ImageLoad(fn, format, w, h);
+	
+	if (!(pix = stbi_load(fn, w, h, &comp, 0)))
+		return 0;
+	
+	// keep gray and gray+alpha as they are, as far as minChannels allows
+	*channels = (comp <= 2 && minChannels <= 2) ? imax(comp, minChannels) : 4;
+	if (comp == *channels)
+		return pix;
+	
+	return ImageExpand(pix, (size_t)*w * *h, comp, *channels);
+}
+
+void ImageFree(void *pix)
+{
+	// stb_image is built with the default allocator, so this covers both
+	free(pix);
+}
+
+bool ImageSave(const char *fn, enum ImageFormat format, int w, int h, const void *pix)
+{
+	size_t sz = (size_t)w * h * 4;
+	uint8_t *data = 0;
+	bool ok;
+	FILE *fp;
+	
+	if (format == IMAGE_FORMAT_PNG)
+		return stbi_write_png(fn, w, h, 4, pix, w * 4);
+	if (format == IMAGE_FORMAT_BMP && !(data = BmpEncode(pix, w, h, &sz)))
+		return false;
+	if (format == IMAGE_FORMAT_QOI && !(data = QoiEncode(pix, w, h, &sz)))
+		return false;
+	
+	if (!(fp = fopen(fn, "wb")))
+	{
+		free(data);
+		return false;
+	}
+	
+	if (format == IMAGE_FORMAT_PAM)
+		fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", w, h);
+	
+	ok = fwrite(data ? data : pix, 1, sz, fp) == sz;
+	ok = !fclose(fp) && ok;
+	
+	free(data);
+	return ok;
+}
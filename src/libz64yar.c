@@ -0,0 +1,470 @@
+/*
+ * libz64yar.c
+ *
+ * in-memory archive access, for programs embedding z64yartool
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "common.h"
+#include "codec.h"
+#include "yaz.h"
+#include "n64texconv.h"
+#include "libz64yar.h"
+
+#define ENTRY_HEADER_SZ 0x10 // codec, decompressed size, and two words
+#define UNYAR_MAX (64 * 1024 * 1024) // surely an archive won't exceed 64 MB
+#define STREAM_CHUNK 0x4000 // handed to the sink of z64yar_extract_stream()
+
+struct BuildPiece
+{
+	uint8_t *data;
+	unsigned int sz;
+};
+
+static const char *sErrors[] =
+{
+	"success"
+	, "invalid argument"
+	, "out of memory"
+	, "malformed archive"
+	, "unknown codec"
+	, "no such entry"
+	, "malformed compressed data"
+	, "compression failed"
+	, "texture conversion failed"
+	, "writing the output failed"
+};
+
+static void Put32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = value >> 24;
+	dst[1] = value >> 16;
+	dst[2] = value >> 8;
+	dst[3] = value;
+}
+
+// validates the archive header and counts its entries
+static int ArchiveCount(const uint8_t *yar, size_t yarSz, int *count)
+{
+	uint32_t headerSz;
+	
+	if (!yar || yarSz < 4)
+		return Z64YAR_ERR_ARCHIVE;
+	
+	headerSz = U32read(yar);
+	if (headerSz < 4 || (headerSz & 3) || headerSz > yarSz)
+		return Z64YAR_ERR_ARCHIVE;
+	
+	*count = headerSz / 4 - 1;
+
+	// a header padded to the alignment repeats the last entry's end
+	// through the padding; those words end the list, as in yar_reencode
+	while (*count > 1 && U32read(yar + *count * 4) == U32read(yar + (*count - 1) * 4))
+		*count -= 1;
+
+	return Z64YAR_OK;
+}
+
+// validates entry 'index' and describes it, except for its unyarAddr
+static int ArchiveEntry(const uint8_t *yar, size_t yarSz, int index, struct z64yar_entry *entry)
+{
+	uint32_t headerSz = U32read(yar);
+	uint32_t start = index ? U32read(yar + index * 4) : 0;
+	uint32_t end = U32read(yar + (index + 1) * 4);
+	const uint8_t *data = yar + headerSz + start;
+	const struct Codec *codec;
+	
+	if (start > end || end > yarSz - headerSz || end - start < ENTRY_HEADER_SZ)
+		return Z64YAR_ERR_ARCHIVE;
+	
+	if (!(codec = CodecFind(data)))
+		return Z64YAR_ERR_CODEC;
+	
+	// Yay0 and MIO0 locate their tables with the last two words
+	if (strcmp(codec->name, "Yaz0")
+		&& (U32read(data + 8) > end - start || U32read(data + 12) > end - start)
+	)
+		return Z64YAR_ERR_ARCHIVE;
+	
+	entry->offset = headerSz + start;
+	entry->size = end - start;
+	entry->unyarSize = U32read(data + 4);
+	if (entry->unyarSize > UNYAR_MAX)
+		return Z64YAR_ERR_ARCHIVE;
+	entry->unyarAddr = 0;
+	entry->codec = codec->name;
+	
+	return Z64YAR_OK;
+}
+
+// finds entry 'index', with its unyarAddr
+static int ArchiveFind(const uint8_t *yar, size_t yarSz, int index, struct z64yar_entry *entry)
+{
+	unsigned int unyarAddr = 0;
+	int count;
+	int err;
+	
+	if ((err = ArchiveCount(yar, yarSz, &count)))
+		return err;
+	
+	if (index < 0 || index >= count)
+		return Z64YAR_ERR_INDEX;
+	
+	for (int i = 0; i <= index; ++i)
+	{
+		if ((err = ArchiveEntry(yar, yarSz, i, entry)))
+			return err;
+		entry->unyarAddr = unyarAddr;
+		unyarAddr += entry->unyarSize;
+		if (unyarAddr > UNYAR_MAX)
+			return Z64YAR_ERR_ARCHIVE;
+	}
+	
+	return Z64YAR_OK;
+}
+
+/* the decoders trust their input, so entries are decoded from a
+ * zero-padded copy that no amount of malformed data can read past
+ */
+static int EntryDecode(const uint8_t *yar, const struct z64yar_entry *entry, void *dst)
+{
+	const struct Codec *codec = CodecFindName(entry->codec);
+	uint8_t *padded = calloc(1, entry->size + (size_t)entry->unyarSize * 2 + 0x20);
+	unsigned unused;
+	int err = Z64YAR_OK;
+	
+	if (!padded)
+		return Z64YAR_ERR_NOMEM;
+	
+	memcpy(padded, yar + entry->offset, entry->size);
+	if (codec->decode(padded, dst, entry->unyarSize, &unused))
+		err = Z64YAR_ERR_DECODE;
+	
+	free(padded);
+	return err;
+}
+
+const char *z64yar_strerror(int err)
+{
+	if (err < 0 || err >= Z64YAR_ERR_MAX)
+		return "unknown error";
+	
+	return sErrors[err];
+}
+
+int z64yar_stat(const void *yar, size_t yarSz, struct z64yar_entry *entries, int maxEntries, int *count)
+{
+	struct z64yar_entry entry;
+	unsigned int unyarAddr = 0;
+	int err;
+	
+	if (!count || (!entries && maxEntries))
+		return Z64YAR_ERR_ARGS;
+	
+	if ((err = ArchiveCount(yar, yarSz, count)))
+		return err;
+	
+	for (int i = 0; i < *count; ++i)
+	{
+		if ((err = ArchiveEntry(yar, yarSz, i, &entry)))
+			return err;
+		entry.unyarAddr = unyarAddr;
+		unyarAddr += entry.unyarSize;
+		if (unyarAddr > UNYAR_MAX)
+			return Z64YAR_ERR_ARCHIVE;
+		
+		if (i < maxEntries)
+			entries[i] = entry;
+	}
+	
+	return Z64YAR_OK;
+}
+
+int z64yar_extract(const void *yar, size_t yarSz, int index, void **data, size_t *dataSz)
+{
+	struct z64yar_entry entry;
+	void *buffer;
+	int err;
+	
+	if (!data || !dataSz)
+		return Z64YAR_ERR_ARGS;
+	
+	if ((err = ArchiveFind(yar, yarSz, index, &entry)))
+		return err;
+	
+	if (!(buffer = malloc(entry.unyarSize + 1)))
+		return Z64YAR_ERR_NOMEM;
+	
+	if ((err = EntryDecode(yar, &entry, buffer)))
+	{
+		free(buffer);
+		return err;
+	}
+	
+	*data = buffer;
+	*dataSz = entry.unyarSize;
+	
+	return Z64YAR_OK;
+}
+
+int z64yar_extract_stream(const void *yar, size_t yarSz, int index
+	, int (*sink)(void *udata, const void *data, size_t sz), void *udata
+)
+{
+	struct z64yar_entry entry;
+	const uint8_t *src;
+	unsigned srcLeft;
+	uint8_t *chunk;
+	void *stream;
+	int rval = YAZ_STREAM_OK;
+	int err;
+	
+	if (!sink)
+		return Z64YAR_ERR_ARGS;
+	
+	if ((err = ArchiveFind(yar, yarSz, index, &entry)))
+		return err;
+	
+	// the other codecs keep their data in three tables, so are decoded whole
+	if (strcmp(entry.codec, "Yaz0"))
+	{
+		void *data;
+		
+		if (!(data = malloc(entry.unyarSize + 1)))
+			return Z64YAR_ERR_NOMEM;
+		
+		if (!(err = EntryDecode(yar, &entry, data))
+			&& sink(udata, data, entry.unyarSize)
+		)
+			err = Z64YAR_ERR_SINK;
+		
+		free(data);
+		return err;
+	}
+	
+	stream = yazStream_new();
+	chunk = malloc(STREAM_CHUNK);
+	if (!stream || !chunk)
+	{
+		yazStream_free(stream);
+		free(chunk);
+		return Z64YAR_ERR_NOMEM;
+	}
+	
+	// the stream decoder checks its own bounds, so needs no padded copy
+	src = (const uint8_t*)yar + entry.offset;
+	srcLeft = entry.size;
+	while (rval == YAZ_STREAM_OK)
+	{
+		unsigned srcUsed;
+		unsigned dstUsed;
+		
+		rval = yazStream_dec(stream, src, srcLeft, &srcUsed, chunk, STREAM_CHUNK, &dstUsed);
+		src += srcUsed;
+		srcLeft -= srcUsed;
+		
+		if (dstUsed && sink(udata, chunk, dstUsed))
+		{
+			err = Z64YAR_ERR_SINK;
+			break;
+		}
+		
+		// out of input with room to spare, so the data was cut short
+		if (rval == YAZ_STREAM_OK && !srcLeft && dstUsed < STREAM_CHUNK)
+			rval = YAZ_STREAM_ERROR;
+	}
+	if (!err && rval == YAZ_STREAM_ERROR)
+		err = Z64YAR_ERR_DECODE;
+	
+	yazStream_free(stream);
+	free(chunk);
+	return err;
+}
+
+int z64yar_unyar(const void *yar, size_t yarSz, void **data, size_t *dataSz)
+{
+	struct z64yar_entry *entries;
+	size_t total = 0;
+	uint8_t *buffer;
+	int count;
+	int err;
+	
+	if (!data || !dataSz)
+		return Z64YAR_ERR_ARGS;
+	
+	if ((err = z64yar_stat(yar, yarSz, 0, 0, &count)))
+		return err;
+	
+	if (!(entries = malloc((count + 1) * sizeof(*entries))))
+		return Z64YAR_ERR_NOMEM;
+	
+	z64yar_stat(yar, yarSz, entries, count, &count);
+	for (int i = 0; i < count; ++i)
+		total += entries[i].unyarSize;
+	
+	if (!(buffer = malloc(total + 1)))
+	{
+		free(entries);
+		return Z64YAR_ERR_NOMEM;
+	}
+	
+	for (int i = 0; i < count && !err; ++i)
+		err = EntryDecode(yar, &entries[i], buffer + entries[i].unyarAddr);
+	
+	free(entries);
+	if (err)
+	{
+		free(buffer);
+		return err;
+	}
+	
+	*data = buffer;
+	*dataSz = total;
+	
+	return Z64YAR_OK;
+}
+
+int z64yar_dump_rgba(const void *yar, size_t yarSz, int index
+	, enum n64texconv_fmt fmt, enum n64texconv_bpp bpp, int width, int height
+	, void **rgba
+)
+{
+	struct z64yar_entry entry;
+	size_t rgbaSz;
+	void *buffer;
+	int err;
+	
+	if (!rgba || width <= 0 || height <= 0
+		|| (size_t)width * height > SIZE_MAX / 4 - ENTRY_HEADER_SZ
+	)
+		return Z64YAR_ERR_ARGS;
+	
+	if ((err = ArchiveFind(yar, yarSz, index, &entry)))
+		return err;
+	
+	// large enough for either, and zeroed in case the entry is short
+	rgbaSz = (size_t)width * height * 4;
+	if (!(buffer = calloc(1, entry.unyarSize > rgbaSz ? entry.unyarSize : rgbaSz)))
+		return Z64YAR_ERR_NOMEM;
+	
+	if ((err = EntryDecode(yar, &entry, buffer)))
+	{
+		free(buffer);
+		return err;
+	}
+	
+	// convert to standard 32-bit rgba, in-place
+	if (n64texconv_to_rgba8888(buffer, buffer, 0, fmt, bpp, width, height))
+	{
+		free(buffer);
+		return Z64YAR_ERR_CONVERT;
+	}
+	
+	*rgba = buffer;
+	
+	return Z64YAR_OK;
+}
+
+int z64yar_build_rgba(const struct z64yar_texture *textures, int count
+	, const char *codecName, int level
+	, void **yar, size_t *yarSz
+)
+{
+	const struct Codec *codec = CodecFindName(codecName ? codecName : "Yaz0");
+	struct BuildPiece *pieces;
+	size_t headerSz = ((size_t)count + 1) * 4;
+	size_t total = headerSz;
+	void *yazCtx;
+	uint8_t *out;
+	int err = Z64YAR_OK;
+	
+	if (!yar || !yarSz || count < 0 || (count && !textures)
+		|| level < 0 || level > YAZ_LEVEL_MAX
+	)
+		return Z64YAR_ERR_ARGS;
+	
+	if (!codec)
+		return Z64YAR_ERR_CODEC;
+	
+	if (!(pieces = calloc(count + 1, sizeof(*pieces))))
+		return Z64YAR_ERR_NOMEM;
+	
+	if (!(yazCtx = yazCtx_new()))
+	{
+		free(pieces);
+		return Z64YAR_ERR_NOMEM;
+	}
+	yazCtx_set_level(yazCtx, level ? level : YAZ_LEVEL_DEFAULT);
+	
+	for (int i = 0; i < count && !err; ++i)
+	{
+		const struct z64yar_texture *tex = &textures[i];
+		size_t rgbaSz = (size_t)tex->width * tex->height * 4;
+		unsigned int sz;
+		uint8_t *pix;
+		
+		if (!tex->rgba || tex->width <= 0 || tex->height <= 0
+			|| (size_t)tex->width * tex->height > UINT_MAX / 8
+		)
+		{
+			err = Z64YAR_ERR_ARGS;
+			break;
+		}
+		
+		// convert a copy to n64 pixel format, in-place
+		if (!(pix = malloc(rgbaSz)))
+		{
+			err = Z64YAR_ERR_NOMEM;
+			break;
+		}
+		memcpy(pix, tex->rgba, rgbaSz);
+		if (n64texconv_to_n64(pix, pix, 0, 0, tex->fmt, tex->bpp, tex->width, tex->height, &sz))
+			err = Z64YAR_ERR_CONVERT;
+		
+		// compress
+		else if (!(pieces[i].data = malloc(YAZ_ENCODE_BOUND(sz))))
+			err = Z64YAR_ERR_NOMEM;
+		else if (codec->encode(pix, sz, pieces[i].data, &pieces[i].sz, yazCtx))
+			err = Z64YAR_ERR_ENCODE;
+		
+		free(pix);
+		total += (pieces[i].sz + 3) & ~3;
+	}
+	yazCtx_free(yazCtx);
+	
+	// assemble header and body, padded to 16 bytes
+	total = (total + 15) & ~15;
+	if (!err && !(out = calloc(1, total)))
+		err = Z64YAR_ERR_NOMEM;
+	if (!err)
+	{
+		size_t end = 0;
+		
+		Put32(out, headerSz);
+		for (int i = 0; i < count; ++i)
+		{
+			memcpy(out + headerSz + end, pieces[i].data, pieces[i].sz);
+			end += (pieces[i].sz + 3) & ~3;
+			Put32(out + (i + 1) * 4, end);
+		}
+		*yar = out;
+		*yarSz = total;
+	}
+	
+	for (int i = 0; i < count; ++i)
+		free(pieces[i].data);
+	free(pieces);
+	
+	return err;
+}
+
+void z64yar_free(void *data)
+{
+	free(data);
+}
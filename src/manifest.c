@@ -0,0 +1,233 @@
+/*
+ * manifest.c
+ *
+ * hash manifests, written beside archives to tell when they've changed
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "manifest.h"
+#include "stretchy_buffer.h"
+
+/* manifest layout, one record per line:
+ *   z64yartool manifest 1
+ *   archive hash size mtime
+ *   recipe size mtime level fit format filename (if built from one)
+ *   entry dataHash pixHash fmt bpp width height size mtime filename
+ * hashes are Hash64() in hex, everything else is decimal, and each
+ * filename runs to the end of its line ("-" if there is none)
+ */
+#define MANIFEST_MAGIC "z64yartool manifest"
+#define MANIFEST_VERSION 1
+
+char *ManifestFilename(const char *yarName)
+{
+	char *fn = malloc(strlen(yarName) + sizeof(".manifest"));
+	
+	assert(fn);
+	
+	strcpy(fn, yarName);
+	strcat(fn, ".manifest");
+	
+	return fn;
+}
+
+// copies the rest of the line, or returns 0 for "-"
+static char *ManifestReadName(const char *str)
+{
+	size_t len = strcspn(str, "\r\n");
+	char *name;
+	
+	if (len == 1 && *str == '-')
+		return 0;
+	
+	name = malloc(len + 1);
+	assert(name);
+	memcpy(name, str, len);
+	name[len] = '\0';
+	
+	return name;
+}
+
+// whether the archive is still the one the manifest describes; when
+// only its mtime has changed (a touch, a fresh checkout), the hash decides
+static bool ManifestArchiveIsSame(const struct Manifest *manifest, const char *yarName, const struct FileStamp *stamp)
+{
+	void *data;
+	size_t sz;
+	bool same;
+	
+	if (FileStampEqual(stamp, &manifest->archiveStamp))
+		return true;
+	
+	if (stamp->size != manifest->archiveStamp.size
+		|| !(data = FileLoad(yarName, &sz))
+	)
+		return false;
+	same = Hash64(data, sz, 0) == manifest->archiveHash;
+	free(data);
+	
+	return same;
+}
+
+struct Manifest *ManifestLoad(const char *yarName)
+{
+	char *fn = ManifestFilename(yarName);
+	char *text = FileLoadAsString(fn);
+	struct Manifest *manifest = calloc(1, sizeof(*manifest));
+	struct FileStamp stamp;
+	bool hasVersion = false;
+	bool ok = text != 0;
+	
+	assert(manifest);
+	free(fn);
+	
+	for (const char *line = text; ok && line; line = StringNextLine(line))
+	{
+		struct ManifestEntry entry = {0};
+		int version;
+		int fit;
+		int len;
+		
+		if (sscanf(line, MANIFEST_MAGIC " %d", &version) == 1)
+			ok = hasVersion = version == MANIFEST_VERSION;
+		else if (!hasVersion)
+			ok = false;
+		else if (sscanf(line, "archive %" SCNx64 " %" SCNd64 " %" SCNd64
+			, &manifest->archiveHash
+			, &manifest->archiveStamp.size
+			, &manifest->archiveStamp.mtime) == 3
+		)
+			continue;
+		else if (sscanf(line, "recipe %" SCNd64 " %" SCNd64 " %d %d %d %n"
+			, &manifest->recipeStamp.size
+			, &manifest->recipeStamp.mtime
+			, &manifest->level
+			, &fit
+			, &manifest->format
+			, &len) == 5
+		)
+		{
+			free(manifest->recipeFilename);
+			manifest->recipeFilename = ManifestReadName(line + len);
+			manifest->fit = fit;
+		}
+		else if (sscanf(line, "entry %" SCNx64 " %" SCNx64 " %d %d %d %d %" SCNd64 " %" SCNd64 " %n"
+			, &entry.dataHash
+			, &entry.pixHash
+			, &entry.fmt
+			, &entry.bpp
+			, &entry.width
+			, &entry.height
+			, &entry.imageStamp.size
+			, &entry.imageStamp.mtime
+			, &len) == 8
+		)
+		{
+			entry.imageFilename = ManifestReadName(line + len);
+			sb_push(manifest->entries, entry);
+		}
+		else
+			ok = false;
+	}
+	free(text);
+	
+	// it describes the archive only as it was when it was written
+	if (!ok
+		|| !hasVersion
+		|| !FileGetStamp(yarName, &stamp)
+		|| !ManifestArchiveIsSame(manifest, yarName, &stamp)
+	)
+	{
+		ManifestFree(manifest);
+		return 0;
+	}
+	
+	return manifest;
+}
+
+bool ManifestSave(struct Manifest *manifest, const char *yarName)
+{
+	char *fn = ManifestFilename(yarName);
+	void *data;
+	size_t sz;
+	FILE *out;
+	bool ok;
+	
+	// the stamp is taken first, so a write in between reads as a change
+	if (!FileGetStamp(yarName, &manifest->archiveStamp)
+		|| !(data = FileLoad(yarName, &sz))
+	)
+	{
+		fprintf(stderr, "failed to read file '%s'\n", yarName);
+		free(fn);
+		return false;
+	}
+	manifest->archiveHash = Hash64(data, sz, 0);
+	free(data);
+	
+	if (!(out = fopen(fn, "w")))
+	{
+		fprintf(stderr, "failed to open '%s' for writing\n", fn);
+		free(fn);
+		return false;
+	}
+	
+	fprintf(out, MANIFEST_MAGIC " %d\n", MANIFEST_VERSION);
+	fprintf(out, "archive %016" PRIx64 " %" PRId64 " %" PRId64 "\n"
+		, manifest->archiveHash
+		, manifest->archiveStamp.size
+		, manifest->archiveStamp.mtime
+	);
+	if (manifest->recipeFilename)
+		fprintf(out, "recipe %" PRId64 " %" PRId64 " %d %d %d %s\n"
+			, manifest->recipeStamp.size
+			, manifest->recipeStamp.mtime
+			, manifest->level
+			, manifest->fit
+			, manifest->format
+			, manifest->recipeFilename
+		);
+	for (int i = 0; i < sb_count(manifest->entries); ++i)
+	{
+		const struct ManifestEntry *entry = &manifest->entries[i];
+		
+		fprintf(out, "entry %016" PRIx64 " %016" PRIx64 " %d %d %d %d %" PRId64 " %" PRId64 " %s\n"
+			, entry->dataHash
+			, entry->pixHash
+			, entry->fmt
+			, entry->bpp
+			, entry->width
+			, entry->height
+			, entry->imageStamp.size
+			, entry->imageStamp.mtime
+			, entry->imageFilename ? entry->imageFilename : "-"
+		);
+	}
+	
+	ok = !ferror(out);
+	if (fclose(out))
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "error writing to file '%s'\n", fn);
+	
+	free(fn);
+	return ok;
+}
+
+void ManifestFree(struct Manifest *manifest)
+{
+	if (!manifest)
+		return;
+	
+	for (int i = 0; i < sb_count(manifest->entries); ++i)
+		free(manifest->entries[i].imageFilename);
+	sb_free(manifest->entries);
+	free(manifest->recipeFilename);
+	free(manifest);
+}
@@ -1,6 +1,7 @@
 /* n64texconv.c -- imported from z64convert, with some tweaks */
 
 #include <math.h>
+#include <string.h>
 
 #include "n64texconv.h"
 
@@ -408,7 +409,7 @@ get_size_bytes(int w, int h, int is_1bit, enum n64texconv_bpp bpp)
 	
 	switch (bpp)
 	{
-		case N64TEXCONV_4:  return (w * h) / 2;
+		case N64TEXCONV_4:  return (w * h + 1) / 2;
 		case N64TEXCONV_8:  return w * h;
 		case N64TEXCONV_16: return w * h * 2;
 		case N64TEXCONV_32: return w * h * 4;
@@ -427,6 +428,44 @@ get_size_bytes(int w, int h, int is_1bit, enum n64texconv_bpp bpp)
 }
 
 
+/* the conversion loop, shared by texture_to_rgba8888 and its copies
+ * for each format below
+ */
+#define TEXTURE_TO_RGBA8888_LOOP(COLORFUNC, IS_CI, BPP) \
+{ \
+	struct vec4b *color = (struct vec4b*)dst; \
+	int is_4bit = (BPP == N64TEXCONV_4); \
+	int bytes = (BPP == N64TEXCONV_32) ? 4 : BPP; /* per pixel, unless 4bpp */ \
+	int i; \
+	\
+	/* work backwards from the last pixel, so that when converting \
+	 * in-place, results never overwrite pixels not yet converted; \
+	 * each pixel is copied out before its result is written over it \
+	 */ \
+	for (i = w * h - 1; i >= 0; --i) \
+	{ \
+		unsigned char  tmp[4]; \
+		unsigned char *b = tmp; \
+		\
+		/* 4bpp: even pixels are the high nibble */ \
+		if (is_4bit) \
+			tmp[0] = (pix[i >> 1] >> ((~i & 1) * 4)) & 15; \
+		else \
+			memcpy(tmp, pix + i * bytes, bytes); \
+		\
+		/* color-indexed */ \
+		if (IS_CI) \
+		{ \
+			/* the * 2 is b/c ci textures have 16-bit color palettes */ \
+			b = pal + tmp[0] * 2; \
+		} \
+		\
+		/* convert pixel */ \
+		COLORFUNC(color + i, b); \
+	} \
+}
+
+
 static
 inline
 void
@@ -440,86 +479,33 @@ texture_to_rgba8888(
 	, int w
 	, int h
 )
-{
-	struct vec4b *color = (struct vec4b*)dst;
-	int is_4bit = (bpp == N64TEXCONV_4);
-	int alt = 1;
-	int i;
-	unsigned int sz;
-	int is_1bit = 0;//(n64_colorfunc == N64_COLOR_FUNC_NAME(onebit));
-	
-	/* determine resulting size */
-	sz = get_size_bytes(w, h, is_1bit, bpp);
-	
-	/* work backwards from end */
-	color += w * h;
-	pix += sz;
-	
-#if 0
-	if (is_1bit)
-	{
-		/* this converter operates on 8 px at a time */
-		/* start with last pixel */
-		--color;
-		for (i=0; i < w * h; i += 8)
-		{
-			/* pixel advancement logic */
-			--pix;
-			
-			/* convert pixel */
-			n64_colorfunc(color, pix);
-			color -= 8;
-		}
-		return;
-	}
-#endif
-	
-	for (i=0; i < w * h; ++i)
-	{
-		/* pixel advancement logic */
-		/* 4bpp */
-		if (is_4bit)
-			pix -= alt & 1;
-		/* 32bpp */
-		else if (bpp == N64TEXCONV_32)
-			pix -= 4;
-		/* 8bpp and 16bpp */
-		else
-			pix -= bpp;
-		--color;
-		
-		unsigned char *b = pix;
-		unsigned char  c;
-		
-		/* 4bpp setup */
-		if (is_4bit)
-		{
-			c = *b;
-			b = &c;
-			if (!(alt&1))
-				c >>=  4;
-			else
-				c &=  15;
-		}
-		
-		/* color-indexed */
-		if (is_ci)
-		{
-			/* the * 2 is b/c ci textures have 16-bit color palettes */
-			
-			/* 4bpp */
-			if (is_4bit)
-				b = pal + c * 2;
-			else
-				b = pal + *pix * 2;
-		}
-		
-		/* convert pixel */
-		n64_colorfunc(color, b);
-		
-		++alt;
-	}
-}
+TEXTURE_TO_RGBA8888_LOOP(n64_colorfunc, is_ci, bpp)
+
+
+/* a copy of the loop for one format, which calls its pixel converter
+ * directly (so it can be inlined) instead of through a pointer
+ */
+#define TEXTURE_TO_RGBA8888(FMT, IS_CI, BPP) \
+static \
+void \
+texture_to_rgba8888_##FMT( \
+	unsigned char *dst \
+	, unsigned char *pix \
+	, unsigned char *pal \
+	, int w \
+	, int h \
+) \
+TEXTURE_TO_RGBA8888_LOOP(N64_COLOR_FUNC_NAME(FMT), IS_CI, BPP)
+
+TEXTURE_TO_RGBA8888(rgba5551, 0, N64TEXCONV_16)
+TEXTURE_TO_RGBA8888(rgba8888, 0, N64TEXCONV_32)
+TEXTURE_TO_RGBA8888(ci4,      1, N64TEXCONV_4)
+TEXTURE_TO_RGBA8888(ci8,      1, N64TEXCONV_8)
+TEXTURE_TO_RGBA8888(ia4,      0, N64TEXCONV_4)
+TEXTURE_TO_RGBA8888(ia8,      0, N64TEXCONV_8)
+TEXTURE_TO_RGBA8888(ia16,     0, N64TEXCONV_16)
+TEXTURE_TO_RGBA8888(i4,       0, N64TEXCONV_4)
+TEXTURE_TO_RGBA8888(i8,       0, N64TEXCONV_8)
 
 
 static
@@ -536,10 +522,12 @@ texture_to_n64(
 	, int w
 	, int h
 	, unsigned int *sz
+	, int channels
 )
 {
 	/* color points to last color */
 	struct vec4b_2n64 *color = (struct vec4b_2n64*)(pix);
+	struct vec4b_2n64 gray;
 	int is_4bit = (bpp == N64TEXCONV_4);
 	int alt = 0;
 	int i;
@@ -553,11 +541,21 @@ texture_to_n64(
 	if (bpp == N64TEXCONV_32)
 		return;
 	
-	for (i=0; i < w * h; ++i, ++color)
+	for (i=0; i < w * h; ++i, pix += channels)
 	{
 		unsigned char *b = dst;
 		unsigned char  c;
 		
+		/* gray (and alpha) pixels are expanded as stb_image would */
+		if (channels == 4)
+			color = (struct vec4b_2n64*)pix;
+		else
+		{
+			gray.x = gray.y = gray.z = pix[0];
+			gray.w = (channels == 2) ? pix[1] : 255;
+			color = &gray;
+		}
+		
 		/* 4bpp setup */
 		if (is_4bit)
 		{
@@ -705,16 +703,50 @@ n64texconv_to_rgba8888(
 		return errstr_palette;
 	
 	/* convert texture using appropriate pixel converter */
-	texture_to_rgba8888(
-		n64_colorfunc_array[fmt * 4 + bpp]
-		, dst
-		, pix
-		, pal
-		, fmt == N64TEXCONV_CI
-		, bpp
-		, w
-		, h
-	);
+	switch (fmt * 4 + bpp)
+	{
+		case N64TEXCONV_RGBA * 4 + N64TEXCONV_16:
+			texture_to_rgba8888_rgba5551(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_RGBA * 4 + N64TEXCONV_32:
+			texture_to_rgba8888_rgba8888(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_CI * 4 + N64TEXCONV_4:
+			texture_to_rgba8888_ci4(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_CI * 4 + N64TEXCONV_8:
+			texture_to_rgba8888_ci8(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_IA * 4 + N64TEXCONV_4:
+			texture_to_rgba8888_ia4(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_IA * 4 + N64TEXCONV_8:
+			texture_to_rgba8888_ia8(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_IA * 4 + N64TEXCONV_16:
+			texture_to_rgba8888_ia16(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_I * 4 + N64TEXCONV_4:
+			texture_to_rgba8888_i4(dst, pix, pal, w, h);
+			break;
+		case N64TEXCONV_I * 4 + N64TEXCONV_8:
+			texture_to_rgba8888_i8(dst, pix, pal, w, h);
+			break;
+		
+		/* 1bit */
+		default:
+			texture_to_rgba8888(
+				n64_colorfunc_array[fmt * 4 + bpp]
+				, dst
+				, pix
+				, pal
+				, fmt == N64TEXCONV_CI
+				, bpp
+				, w
+				, h
+			);
+			break;
+	}
 	
 	/* success */
 	return 0;
@@ -782,6 +814,7 @@ n64texconv_to_n64(
 		, w
 		, h
 		, sz
+		, 4
 	);
 	
 	/* success */
@@ -789,6 +822,75 @@ n64texconv_to_n64(
 }
 
 
+int
+n64texconv_gray_channels(
+	enum n64texconv_fmt fmt
+	, enum n64texconv_bpp bpp
+)
+{
+	/* output must not outgrow the input when converting in-place */
+	if (fmt == N64TEXCONV_I && (bpp == N64TEXCONV_4 || bpp == N64TEXCONV_8))
+		return 1;
+	
+	if (fmt == N64TEXCONV_IA && (bpp == N64TEXCONV_4 || bpp == N64TEXCONV_8))
+		return 1;
+	
+	if (fmt == N64TEXCONV_IA && bpp == N64TEXCONV_16)
+		return 2;
+	
+	return 0;
+}
+
+
+const char *
+n64texconv_to_n64_from_gray(
+	unsigned char *dst
+	, unsigned char *pix
+	, int channels
+	, enum n64texconv_fmt fmt
+	, enum n64texconv_bpp bpp
+	, int w
+	, int h
+	, unsigned int *sz
+)
+{
+	int min_channels = n64texconv_gray_channels(fmt, bpp);
+	unsigned int sz_unused;
+	
+	/* rgba8888 goes the usual way */
+	if (channels == 4)
+		return n64texconv_to_n64(dst, pix, 0, 0, fmt, bpp, w, h, sz);
+	
+	if (!dst || !pix)
+		return "no buffer";
+	
+	if (!min_channels || channels < min_channels || channels > 2)
+		return "invalid format for gray pixels";
+	
+	if (w <= 0 || h <= 0)
+		return "invalid dimensions (<= 0)";
+	
+	if (!sz)
+		sz = &sz_unused;
+	
+	texture_to_n64(
+		n64_colorfunc_array_to[fmt * 4 + bpp]
+		, dst
+		, pix
+		, 0
+		, 0
+		, 0
+		, bpp
+		, w
+		, h
+		, sz
+		, channels
+	);
+	
+	return 0;
+}
+
+
 const char *
 n64texconv_to_n64_and_back(
 	unsigned char *pix
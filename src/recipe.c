@@ -5,6 +5,16 @@
  *
  */
 
+#ifdef _WIN32
+#include <direct.h> // _getcwd
+#define getcwd _getcwd
+#define IS_SEP(C) ((C) == '/' || (C) == '\\')
+#else
+#define _POSIX_C_SOURCE 200809L // getcwd
+#include <unistd.h>
+#define IS_SEP(C) ((C) == '/')
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,168 +23,913 @@
 #include "recipe.h"
 #include "common.h"
 
-struct Recipe *RecipeRead(const char *filename)
+#include "stretchy_buffer.h"
+
+static char *RecipeDirectory(struct Arena *arena, const char *filename)
 {
-	struct Recipe *recipe = calloc(1, sizeof(*recipe));
-	char *data = FileLoadAsString(filename);
-	struct RecipeItem *prev = 0;
-	const char *step;
-	 // color-indexed formats are unsupported for now
-	const char *knownFmt = "rgba16, rgba32, ia4, ia8, ia16, i4, i8";
+	const char *ss0 = strrchr(filename, '/');
+	const char *ss1 = strrchr(filename, '\\'); // win32
 	
-	if (!data)
+	if (ss0 == ss1) // doesn't contain slashes
+		return ArenaStrdup(arena, "");
+	else if (ss0 > ss1)
+		return ArenaStrndup(arena, filename, (ss0 - filename) + 1);
+	else
+		return ArenaStrndup(arena, filename, (ss1 - filename) + 1);
+}
+
+static bool RecipePathIsAbsolute(const char *path)
+{
+#ifdef _WIN32
+	if (*path && path[1] == ':') // drive letter
+		return true;
+#endif
+	return IS_SEP(*path);
+}
+
+// splits 'full' in place into its components, dropping "." and
+// resolving ".." as it goes; returns a stretchy buffer
+static char **RecipePathSplit(char *full)
+{
+	char **parts = 0;
+	
+	while (*full)
 	{
-		fprintf(stderr, "failed to load file '%s'\n", filename);
-		exit(EXIT_FAILURE);
+		char *part = full;
+		
+		while (*full && !IS_SEP(*full))
+			++full;
+		if (*full)
+			*(full++) = '\0';
+		
+		if (!*part || !strcmp(part, "."))
+			continue;
+		else if (!strcmp(part, ".."))
+		{
+			if (sb_count(parts))
+				stb__sbn(parts) -= 1;
+		}
+		else
+			sb_push(parts, part);
 	}
 	
-	assert(recipe);
+	return parts;
+}
+
+// prefixes a path relative to the working directory with it, so
+// it can be split and compared; returns 0 if there is no cwd
+static char *RecipePathAbsolute(const char *path)
+{
+	char cwd[4096];
+	char *full;
 	
-	step = data;
-	while (*step == '#')
-		step = StringNextLine(step);
+	if (RecipePathIsAbsolute(path))
+		cwd[0] = '\0';
+	else if (!getcwd(cwd, sizeof(cwd)))
+		return 0;
 	
-	recipe->filename = Strdup(filename);
-	recipe->directory = FileGetDirectory(filename);
-	recipe->behavior = StrdupContiguous(step);
+	full = malloc(strlen(cwd) + strlen(path) + 2);
+	assert(full);
+	sprintf(full, "%s/%s", cwd, path);
 	
-	assert(step);
+	return full;
+}
+
+// rewrites 'path' (relative to the working directory) so it is
+// relative to the directory 'dir' instead; used for storing paths
+// in a compiled recipe, which may be read from anywhere
+static char *RecipePathRelative(struct Arena *arena, const char *path, const char *dir)
+{
+	char *fullPath = RecipePathAbsolute(path);
+	char *fullDir = RecipePathAbsolute(dir);
+	char **pathParts;
+	char **dirParts;
+	char *result = 0; // stretchy buffer
+	char *str;
+	int common = 0;
+	int ups;
 	
-	// not a behavior
-	if (recipe->behavior[0] != '*')
+	// no working directory to go by; keep it as it was
+	if (!fullPath || !fullDir)
 	{
-		recipe->yarName = Strdup(recipe->behavior);
-		strcpy(recipe->behavior, "");
+		free(fullPath);
+		free(fullDir);
+		return ArenaStrdup(arena, path);
 	}
-	else
+	
+	pathParts = RecipePathSplit(fullPath);
+	dirParts = RecipePathSplit(fullDir);
+	while (common < sb_count(pathParts)
+		&& common < sb_count(dirParts)
+		&& !strcmp(pathParts[common], dirParts[common])
+	)
+		++common;
+	
+	ups = sb_count(dirParts) - common;
+#ifdef _WIN32
+	// on another drive, only an absolute path will do
+	if (!common)
+		ups = 0;
+#endif
+	
+	for (int i = 0; i < ups; ++i)
+		memcpy(sb_add(result, 3), "../", 3);
+	for (int i = common; i < sb_count(pathParts); ++i)
 	{
-		step = StringNextLine(step);
-		recipe->yarName = StrdupContiguous(step);
+		int len = strlen(pathParts[i]);
+		
+		memcpy(sb_add(result, len), pathParts[i], len);
+		if (i + 1 < sb_count(pathParts) || !*path || IS_SEP(path[strlen(path) - 1]))
+			sb_push(result, '/');
 	}
 	
-	step = StringNextLine(step);
-	recipe->imageDir = StrdupContiguous(step);
+	str = ArenaStrndup(arena, result ? result : "", sb_count(result));
+	sb_free(result);
+	sb_free(pathParts);
+	sb_free(dirParts);
+	free(fullPath);
+	free(fullDir);
 	
-	// ensure ends in a slash
-	if ((strrchr(recipe->imageDir, '/') + 1) != (recipe->imageDir + strlen(recipe->imageDir)))
+	return str;
+}
+
+// resolves a path stored relative to directory 'dir'
+static char *RecipeResolve(struct Arena *arena, const char *dir, char *path)
+{
+	if (!*dir || RecipePathIsAbsolute(path))
+		return path;
+	
+	return ArenaStrjoin(arena, dir, path);
+}
+
+// link the contiguous items so they can still be walked as a list
+static void RecipeLinkItems(struct Recipe *recipe)
+{
+	recipe->head = recipe->items;
+	for (int i = 0; i < recipe->count - 1; ++i)
+		recipe->items[i].next = &recipe->items[i + 1];
+}
+
+// color-indexed formats are only supported by retexture recipes
+static const char *knownFmt = "rgba16, rgba32, ia4, ia8, ia16, i4, i8, ci4-n, ci8-n";
+
+// parses a non-negative decimal integer, returns 0 if no digits
+static const char *RecipeParseInt(const char *str, int *result)
+{
+	int v = 0;
+	
+	if (*str < '0' || *str > '9')
+		return 0;
+	
+	while (*str >= '0' && *str <= '9')
+		v = v * 10 + (*(str++) - '0');
+	
+	*result = v;
+	return str;
+}
+
+// parses a hexadecimal integer (optional 0x prefix), returns 0 if no digits
+static const char *RecipeParseHex(const char *str, unsigned int *result)
+{
+	unsigned int v = 0;
+	const char *start;
+	
+	if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+		str += 2;
+	
+	for (start = str; ; ++str)
 	{
-		fprintf(stderr, "imageDir '%s' does not end in '/' as expected, please add one\n", recipe->imageDir);
-		exit(EXIT_FAILURE);
+		if (*str >= '0' && *str <= '9')
+			v = (v << 4) | (*str - '0');
+		else if (*str >= 'a' && *str <= 'f')
+			v = (v << 4) | (*str - 'a' + 10);
+		else if (*str >= 'A' && *str <= 'F')
+			v = (v << 4) | (*str - 'A' + 10);
+		else
+			break;
 	}
 	
-	// guarantee relative paths
-	StringPrependInplace(&recipe->yarName, recipe->directory);
-	StringPrependInplace(&recipe->imageDir, recipe->directory);
-	
-	for (step = StringNextLine(step); step; step = StringNextLine(step))
-	{
-		struct RecipeItem *this = calloc(1, sizeof(*this));
-		char *tmp = StrdupContiguous(step);
-		char fmt[32];
-		char filename[512];
-		int palId = -1;
-		int palMaxColors = 0;
-		int width;
-		int height;
-		unsigned int writeAt = -1;
+	if (str == start)
+		return 0;
+	
+	*result = v;
+	return str;
+}
+
+// looks up a texture format by name, returns false if unknown
+static bool RecipeLookupFormat(const char *str, int len, struct RecipeItem *item)
+{
+	#define FMT(NAME, FMT, BPP) \
+		if (!memcmp(str, NAME, len)) \
+		{ \
+			item->fmt = N64TEXCONV_##FMT; \
+			item->bpp = N64TEXCONV_##BPP; \
+			return true; \
+		}
+	
+	switch (len)
+	{
+		case 2:
+			FMT("i4", I, 4)
+			FMT("i8", I, 8)
+			break;
 		
-		recipe->count += 1;
+		case 3:
+			FMT("ia4", IA, 4)
+			FMT("ia8", IA, 8)
+			FMT("ci4", CI, 4)
+			FMT("ci8", CI, 8)
+			break;
 		
-		assert(this);
+		case 4:
+			FMT("ia16", IA, 16)
+			break;
 		
-		if (sscanf(tmp, "%dx%d,%[^,],%[^, #\r\n],%x", &width, &height, fmt, filename, &writeAt) < 4
-			&& sscanf(tmp, "%d,pal-%d,%[^,],%[^, #\r\n],%x", &palMaxColors, &palId, fmt, filename, &writeAt) < 4
-		)
+		case 6:
+			FMT("rgba16", RGBA, 16)
+			FMT("rgba32", RGBA, 32)
+			break;
+	}
+	
+	return false;
+	
+	#undef FMT
+}
+
+// parses one 'WxH,fmt,name[,offset]' or 'N,pal-ID,fmt,name[,offset]' line
+// in place; returns 0 on success, or an error message with *errAt set to
+// the offending character
+static const char *RecipeParseItem(
+	const char *str
+	, struct RecipeItem *item
+	, const char **name
+	, int *nameLen
+	, const char **errAt
+)
+{
+	const char *fmt;
+	const char *next;
+	int first;
+	
+	#define EXPECT(CHAR, ERRMSG) \
+		if (*str != CHAR) \
+		{ \
+			*errAt = str; \
+			return ERRMSG; \
+		} \
+		++str;
+	
+	item->palId = -1;
+	item->palMaxColors = 0;
+	item->writeAt = -1;
+	
+	// 'WxH' or 'N,pal-ID'
+	if (!(next = RecipeParseInt(str, &first)))
+	{
+		*errAt = str;
+		return "expected texture width or palette size";
+	}
+	str = next;
+	if (*str == 'x')
+	{
+		++str;
+		item->width = first;
+		if (!(next = RecipeParseInt(str, &item->height)))
 		{
-			fprintf(stderr, "unexpectedly formatted line: '%s'\n", tmp);
-			exit(EXIT_FAILURE);
+			*errAt = str;
+			return "expected texture height";
 		}
-		
-		// TODO check each combination individually since there are so few
-		if (strstr(fmt, "rgba"))
-			this->fmt = N64TEXCONV_RGBA;
-		else if (strstr(fmt, "ci")) // color-indexed formats are unsupported for now
-			this->fmt = N64TEXCONV_CI;
-		else if (strstr(fmt, "ia"))
-			this->fmt = N64TEXCONV_IA;
-		else if (strstr(fmt, "i"))
-			this->fmt = N64TEXCONV_I;
-		else
+		str = next;
+	}
+	else if (*str == ',' && !strncmp(str + 1, "pal-", 4))
+	{
+		str += 5;
+		item->palMaxColors = first;
+		if (!(next = RecipeParseInt(str, &item->palId)))
 		{
-			fprintf(stderr, "unknown texture format '%s', valid formats:\n%s\n", fmt, knownFmt);
-			exit(EXIT_FAILURE);
+			*errAt = str;
+			return "expected palette id";
 		}
-		if (strstr(fmt, "4"))
-			this->bpp = N64TEXCONV_4;
-		else if (strstr(fmt, "8"))
-			this->bpp = N64TEXCONV_8;
-		else if (strstr(fmt, "16"))
-			this->bpp = N64TEXCONV_16;
-		else if (strstr(fmt, "32"))
-			this->bpp = N64TEXCONV_32;
-		else
+		str = next;
+	}
+	else
+	{
+		*errAt = str;
+		return "expected 'x' or ',pal-'";
+	}
+	EXPECT(',', "expected ',' before texture format")
+	
+	// texture format
+	for (fmt = str; (*str >= 'a' && *str <= 'z') || (*str >= '0' && *str <= '9'); ++str)
+		;
+	if (!RecipeLookupFormat(fmt, str - fmt, item))
+	{
+		*errAt = fmt;
+		return "unknown texture format";
+	}
+	if (item->fmt == N64TEXCONV_CI)
+	{
+		// ci4 and ci8 are expected to end in -n, where n = palette id
+		if (*str != '-' || !(next = RecipeParseInt(str + 1, &item->palId)))
+		{
+			*errAt = str;
+			return "ci format must specify its palette (for example: ci8-0 uses palette 0)";
+		}
+		str = next;
+	}
+	EXPECT(',', "expected ',' after texture format")
+	
+	// name
+	*name = str;
+	while (*str && !strchr(", #\t\r\n", *str))
+		++str;
+	*nameLen = str - *name;
+	if (!*nameLen)
+	{
+		*errAt = str;
+		return "expected image filename";
+	}
+	
+	// optional offset
+	if (*str == ',')
+	{
+		++str;
+		if (!(next = RecipeParseHex(str, &item->writeAt)))
 		{
-			fprintf(stderr, "unknown texture format '%s', valid formats:\n%s\n", fmt, knownFmt);
-			exit(EXIT_FAILURE);
+			*errAt = str;
+			return "expected hexadecimal offset";
 		}
+		str = next;
+	}
+	
+	// anything after whitespace or '#' is a comment
+	if (*str && !strchr(" #\t\r\n", *str))
+	{
+		*errAt = str;
+		return "unexpected character";
+	}
+	
+	return 0;
+	
+	#undef EXPECT
+}
+
+static void RecipeParseError(
+	const char *filename
+	, const char *lineStart
+	, int line
+	, const char *errAt
+	, const char *errmsg
+)
+{
+	int lineLen = strcspn(lineStart, "\r\n");
+	int column = (errAt - lineStart) + 1;
+	
+	fprintf(stderr, "%s:%d:%d: %s\n", filename, line, column, errmsg);
+	fprintf(stderr, " %.*s\n", lineLen, lineStart);
+	fprintf(stderr, " %*s^\n", column - 1, "");
+}
+
+// recipes are read through a fixed-size window, so arbitrarily
+// large recipes never have to be loaded into memory all at once
+#define RECIPE_STREAM_BUFSZ (16 * 1024)
+
+struct RecipeStream
+{
+	FILE *fp;
+	char *buf; // RECIPE_STREAM_BUFSZ + 1, always zero-terminated
+	int start; // start of unread data in buf
+	int end; // end of valid data in buf
+	int line; // line number of the most recent line returned
+	int lineNext; // line number of the line at buf + start
+	char *imageFilename; // imageDir followed by the current name
+	int imageDirLen;
+	struct RecipeItem item; // the item most recently returned
+	struct RecipeItem *nextItem; // for recipes whose items are loaded
+	bool isFatal; // errors exit, instead of ending the stream early
+	bool hasFailed;
+};
+
+// called once a stream error has been printed; exits, or returns 0
+// (as if at the end of the file), depending on how it was opened
+static void *RecipeStreamFail(struct RecipeStream *stream)
+{
+	if (stream->isFatal)
+		exit(EXIT_FAILURE);
+	
+	stream->hasFailed = true;
+	
+	return 0;
+}
+
+// returns the next non-blank line (newline or zero-terminated, with
+// leading whitespace skipped), or 0 at the end of the file; the line
+// remains valid until the next call
+static const char *RecipeStreamLine(struct Recipe *recipe)
+{
+	struct RecipeStream *stream = recipe->stream;
+	
+	for (;;)
+	{
+		char *str = stream->buf + stream->start;
+		char *eol = memchr(str, '\n', stream->end - stream->start);
 		
-		// get palette id
-		if (this->fmt == N64TEXCONV_CI)
+		// need more data for a complete line
+		if (!eol && stream->fp)
 		{
-			if (!strrchr(fmt, '-')
-				|| sscanf(strrchr(fmt, '-') + 1, "%d", &palId) != 1
-			)
+			int have = stream->end - stream->start;
+			
+			if (have == RECIPE_STREAM_BUFSZ)
+			{
+				fprintf(stderr, "%s:%d: line too long\n", recipe->filename, stream->lineNext);
+				return RecipeStreamFail(stream);
+			}
+			
+			memmove(stream->buf, str, have);
+			stream->start = 0;
+			stream->end = have;
+			stream->end += fread(stream->buf + have, 1, RECIPE_STREAM_BUFSZ - have, stream->fp);
+			stream->buf[stream->end] = '\0';
+			
+			if (stream->end < RECIPE_STREAM_BUFSZ)
 			{
-				fprintf(stderr, "provided ci format w/o specifying which palette: '%s'\n", fmt);
-				fprintf(stderr, "(ci4 and ci8 are expected to end in -n, where n = palette id)\n");
-				fprintf(stderr, "(for example: ci8-0 specifies ci8 format using palette 0)\n");
-				exit(EXIT_FAILURE);
+				fclose(stream->fp);
+				stream->fp = 0;
 			}
+			continue;
 		}
 		
-		this->width = width;
-		this->height = height;
-		this->writeAt = writeAt;
-		this->palId = palId;
-		this->palMaxColors = palMaxColors;
+		// end of file
+		if (!eol && stream->start == stream->end)
+			return 0;
 		
-		if (palMaxColors && !strcmp(filename, "auto"))
-			this->imageFilename = Strdup(filename);
-		else
+		stream->line = stream->lineNext;
+		if (eol)
 		{
-			this->imageFilename = malloc(strlen(recipe->imageDir) + strlen(filename) + 1);
-			sprintf(this->imageFilename, "%s%s", recipe->imageDir, filename);
+			stream->start = (eol - stream->buf) + 1;
+			stream->lineNext += 1;
 		}
-		
-		if (prev)
-			prev->next = this;
 		else
-			recipe->head = this;
-		prev = this;
+			stream->start = stream->end;
+		
+		// skip blank lines
+		str += strspn(str, " \t\r");
+		if (*str && *str != '\n')
+			return str;
+	}
+}
+
+static struct Recipe *RecipeOpenText(const char *filename, bool isFatal)
+{
+	struct Recipe *recipe = calloc(1, sizeof(*recipe));
+	struct RecipeStream *stream = calloc(1, sizeof(*stream));
+	struct Arena *arena;
+	const char *step;
+	
+	#define FAIL \
+	{ \
+		RecipeFree(recipe); \
+		if (isFatal) \
+			exit(EXIT_FAILURE); \
+		return 0; \
+	}
+	
+	assert(recipe);
+	assert(stream);
+	
+	recipe->stream = stream;
+	stream->isFatal = isFatal;
+	if (!(stream->fp = fopen(filename, "rb")))
+	{
+		fprintf(stderr, "failed to load file '%s'\n", filename);
+		FAIL
+	}
+	stream->buf = malloc(RECIPE_STREAM_BUFSZ + 1);
+	assert(stream->buf);
+	stream->buf[0] = '\0';
+	stream->lineNext = 1;
+	
+	// holds the header strings; items loaded later add to it
+	arena = ArenaNew(64 * 1024);
+	recipe->arena = arena;
+	recipe->filename = ArenaStrdup(arena, filename);
+	recipe->directory = RecipeDirectory(arena, filename);
+	
+	while ((step = RecipeStreamLine(recipe)) && *step == '#')
+		;
+	
+	if (!step)
+	{
+		if (!stream->hasFailed)
+			fprintf(stderr, "%s: recipe is empty\n", filename);
+		FAIL
+	}
+	
+	recipe->behavior = ArenaStrdupContiguous(arena, step);
+	
+	// not a behavior
+	if (recipe->behavior[0] != '*')
+	{
+		recipe->yarName = recipe->behavior;
+		recipe->behavior = ArenaStrdup(arena, "");
+	}
+	else if ((step = RecipeStreamLine(recipe)))
+		recipe->yarName = ArenaStrdupContiguous(arena, step);
+	
+	if (!step || !(step = RecipeStreamLine(recipe)))
+	{
+		if (!stream->hasFailed)
+			fprintf(stderr, "%s:%d: expected image directory\n", filename, stream->lineNext);
+		FAIL
+	}
+	recipe->imageDir = ArenaStrdupContiguous(arena, step);
+	
+	// ensure ends in a slash
+	if ((strrchr(recipe->imageDir, '/') + 1) != (recipe->imageDir + strlen(recipe->imageDir)))
+	{
+		fprintf(stderr, "%s:%d: imageDir '%s' does not end in '/' as expected, please add one\n"
+			, filename, stream->line, recipe->imageDir
+		);
+		FAIL
+	}
+	
+	// guarantee relative paths
+	recipe->yarName = ArenaStrjoin(arena, recipe->directory, recipe->yarName);
+	recipe->imageDir = ArenaStrjoin(arena, recipe->directory, recipe->imageDir);
+	
+	// a name can't be longer than the line containing it
+	stream->imageDirLen = strlen(recipe->imageDir);
+	stream->imageFilename = malloc(stream->imageDirLen + RECIPE_STREAM_BUFSZ + 1);
+	assert(stream->imageFilename);
+	memcpy(stream->imageFilename, recipe->imageDir, stream->imageDirLen);
+	
+	return recipe;
+	
+	#undef FAIL
+}
+
+struct RecipeItem *RecipeNext(struct Recipe *recipe)
+{
+	struct RecipeStream *stream = recipe->stream;
+	struct RecipeItem *this = &stream->item;
+	const char *errmsg;
+	const char *errAt;
+	const char *step;
+	const char *name;
+	int nameLen;
+	
+	// items have already been loaded
+	if (!stream->imageFilename)
+	{
+		this = stream->nextItem;
+		if (this)
+			stream->nextItem = this->next;
+		return this;
+	}
+	
+	// skip comment lines
+	while ((step = RecipeStreamLine(recipe)) && *step == '#')
+		;
+	
+	if (!step)
+		return 0;
+	
+	memset(this, 0, sizeof(*this));
+	if ((errmsg = RecipeParseItem(step, this, &name, &nameLen, &errAt)))
+	{
+		RecipeParseError(recipe->filename, step, stream->line, errAt, errmsg);
+		if (!strcmp(errmsg, "unknown texture format"))
+			fprintf(stderr, "valid formats: %s\n", knownFmt);
+		return RecipeStreamFail(stream);
+	}
+	
+	if (this->palMaxColors && nameLen == 4 && !memcmp(name, "auto", 4))
+		this->imageFilename = "auto";
+	else
+	{
+		this->imageFilename = stream->imageFilename;
+		memcpy(this->imageFilename + stream->imageDirLen, name, nameLen);
+		this->imageFilename[stream->imageDirLen + nameLen] = '\0';
+	}
+	
+	return this;
+}
+
+void RecipeLoadItems(struct Recipe *recipe)
+{
+	struct RecipeStream *stream = recipe->stream;
+	struct RecipeItem *item;
+	
+	// already loaded
+	if (!stream->imageFilename)
+		return;
+	
+	while ((item = RecipeNext(recipe)))
+	{
+		struct RecipeItem *this = sb_add(recipe->items, 1);
+		
+		*this = *item;
+		this->imageFilename = ArenaStrdup(recipe->arena, item->imageFilename);
+		recipe->count += 1;
+	}
+	
+	RecipeLinkItems(recipe);
+	
+	// subsequent RecipeNext() calls walk the loaded items
+	free(stream->imageFilename);
+	stream->imageFilename = 0;
+	stream->nextItem = recipe->head;
+}
+
+/* compiled recipe layout (all words big-endian):
+ * 0x00  "YRCP"
+ * 0x04  version
+ * 0x08  item count
+ * 0x0C  string table offset
+ * 0x10  string table size
+ * 0x14  string offsets: filename, directory, behavior, yarName, imageDir
+ * 0x28  reserved
+ * 0x30  item records, RECIPE_BIN_ITEM_SZ bytes each:
+ *       imageFilename, width, height, palId, palMaxColors, fmt, bpp, writeAt
+ * ....  string table (zero-terminated strings, paths relative to the
+ *       compiled recipe's own directory unless they are absolute)
+ */
+#define RECIPE_BIN_MAGIC "YRCP"
+#define RECIPE_BIN_VERSION 2
+#define RECIPE_BIN_HEADER_SZ 0x30
+#define RECIPE_BIN_ITEM_SZ 0x20
+
+static struct Recipe *RecipeReadCompiled(const char *filename, bool isFatal)
+{
+	struct Recipe *recipe = calloc(1, sizeof(*recipe));
+	struct FileStamp stamp;
+	uint8_t *data;
+	uint8_t *record;
+	char *strings;
+	uint32_t count;
+	uint32_t stringsOfs;
+	uint32_t stringsSz;
+	const char *binDir;
+	FILE *fp;
+	
+	#define STRING(OFS) (strings + U32read(OFS))
+	#define PATH(OFS) RecipeResolve(recipe->arena, binDir, STRING(OFS))
+	#define FAIL(ERRMSG) \
+	{ \
+		fprintf(stderr, "compiled recipe '%s': %s\n", filename, ERRMSG); \
+		RecipeFree(recipe); \
+		if (isFatal) \
+			exit(EXIT_FAILURE); \
+		return 0; \
+	}
+	
+	assert(recipe);
+	
+	// the whole file becomes the recipe's storage, and the strings
+	// are used where they sit unless they are paths to be resolved
+	if (!FileGetStamp(filename, &stamp)
+		|| stamp.size < RECIPE_BIN_HEADER_SZ
+		|| !(fp = fopen(filename, "rb"))
+	)
+		FAIL("failed to open")
+	recipe->arena = ArenaNew(stamp.size);
+	data = ArenaAlloc(recipe->arena, stamp.size);
+	if (fread(data, 1, stamp.size, fp) != (size_t)stamp.size)
+	{
+		fclose(fp);
+		FAIL("read error")
+	}
+	fclose(fp);
+	
+	// validate the header
+	if (memcmp(data, RECIPE_BIN_MAGIC, 4))
+		FAIL("not a compiled recipe")
+	if (U32read(data + 0x04) != RECIPE_BIN_VERSION)
+		FAIL("unsupported version, please recompile it")
+	count = U32read(data + 0x08);
+	stringsOfs = U32read(data + 0x0C);
+	stringsSz = U32read(data + 0x10);
+	if (stringsOfs != RECIPE_BIN_HEADER_SZ + (uint64_t)count * RECIPE_BIN_ITEM_SZ
+		|| stringsOfs + (uint64_t)stringsSz != (uint64_t)stamp.size
+		|| stringsSz == 0
+		|| data[stamp.size - 1] != '\0'
+	)
+		FAIL("file is truncated or corrupt")
+	strings = (char*)data + stringsOfs;
+	for (uint32_t i = 0x14; i < 0x28; i += 4)
+		if (U32read(data + i) >= stringsSz)
+			FAIL("string offset out of range")
+	
+	binDir = RecipeDirectory(recipe->arena, filename);
+	recipe->filename = PATH(data + 0x14);
+	recipe->directory = PATH(data + 0x18);
+	recipe->behavior = STRING(data + 0x1C);
+	recipe->yarName = PATH(data + 0x20);
+	recipe->imageDir = PATH(data + 0x24);
+	
+	// fixed-size records map directly onto items
+	record = data + RECIPE_BIN_HEADER_SZ;
+	if (count)
+		memset(sb_add(recipe->items, (int)count), 0, count * sizeof(*recipe->items));
+	for (uint32_t i = 0; i < count; ++i, record += RECIPE_BIN_ITEM_SZ)
+	{
+		struct RecipeItem *this = &recipe->items[i];
 		
-		free(tmp);
+		if (U32read(record) >= stringsSz
+			|| U32read(record + 0x14) >= N64TEXCONV_FMT_MAX
+			|| U32read(record + 0x18) > N64TEXCONV_32
+		)
+			FAIL("item record is corrupt")
+		
+		this->imageFilename = STRING(record);
+		if (strcmp(this->imageFilename, "auto"))
+			this->imageFilename = PATH(record);
+		this->width = U32read(record + 0x04);
+		this->height = U32read(record + 0x08);
+		this->palId = U32read(record + 0x0C);
+		this->palMaxColors = U32read(record + 0x10);
+		this->fmt = U32read(record + 0x14);
+		this->bpp = U32read(record + 0x18);
+		this->writeAt = U32read(record + 0x1C);
 	}
+	recipe->count = count;
+	RecipeLinkItems(recipe);
+	
+	recipe->stream = calloc(1, sizeof(*recipe->stream));
+	assert(recipe->stream);
+	recipe->stream->nextItem = recipe->head;
 	
-	free(data);
 	return recipe;
+	
+	#undef STRING
+	#undef PATH
+	#undef FAIL
 }
 
-void RecipeFree(struct Recipe *recipe)
+static bool RecipeIsCompiled(const char *filename)
 {
-	struct RecipeItem *next = 0;
+	FILE *fp = fopen(filename, "rb");
+	char magic[4];
+	bool result;
 	
-	for (struct RecipeItem *this = recipe->head; this; this = next)
+	if (!fp)
+		return false;
+	
+	result = fread(magic, 1, 4, fp) == 4 && !memcmp(magic, RECIPE_BIN_MAGIC, 4);
+	fclose(fp);
+	
+	return result;
+}
+
+static struct Recipe *RecipeOpenEx(const char *filename, bool isFatal)
+{
+	struct Recipe *recipe;
+	struct FileStamp binStamp;
+	struct FileStamp srcStamp;
+	
+	if (!RecipeIsCompiled(filename))
+		return RecipeOpenText(filename, isFatal);
+	
+	if (!(recipe = RecipeReadCompiled(filename, isFatal)))
+		return 0;
+	
+	// the source text was edited after compiling; don't use stale data
+	if (FileGetStamp(filename, &binStamp)
+		&& FileGetStamp(recipe->filename, &srcStamp)
+		&& srcStamp.mtime > binStamp.mtime
+	)
+	{
+		struct Recipe *text = RecipeOpenText(recipe->filename, isFatal);
+		
+		fprintf(stderr, "'%s' is newer than '%s', reading it instead\n"
+			, recipe->filename, filename
+		);
+		RecipeFree(recipe);
+		
+		return text;
+	}
+	
+	return recipe;
+}
+
+struct Recipe *RecipeOpen(const char *filename)
+{
+	return RecipeOpenEx(filename, true);
+}
+
+struct Recipe *RecipeRead(const char *filename)
+{
+	struct Recipe *recipe = RecipeOpen(filename);
+	
+	RecipeLoadItems(recipe);
+	
+	return recipe;
+}
+
+struct Recipe *RecipeLoad(const char *filename)
+{
+	struct Recipe *recipe = RecipeOpenEx(filename, false);
+	
+	if (!recipe)
+		return 0;
+	
+	RecipeLoadItems(recipe);
+	if (recipe->stream->hasFailed)
+	{
+		RecipeFree(recipe);
+		return 0;
+	}
+	
+	return recipe;
+}
+
+// appends a string to a compiled recipe's string table, returns its offset
+static uint32_t RecipeCompileString(char **strings, const char *str)
+{
+	int len = strlen(str) + 1;
+	uint32_t ofs = sb_count(*strings);
+	
+	memcpy(sb_add(*strings, len), str, len);
+	
+	return ofs;
+}
+
+int RecipeCompile(struct Recipe *recipe, const char *outfn)
+{
+	char *strings = 0;
+	const char *outDir = RecipeDirectory(recipe->arena, outfn);
+	FILE *out;
+	
+	#define STRING(STR) RecipeCompileString(&strings, STR)
+	#define PATH(STR) STRING(RecipePathRelative(recipe->arena, STR, outDir))
+	
+	if (!(out = fopen(outfn, "wb")))
+	{
+		fprintf(stderr, "failed to open '%s' for writing\n", outfn);
+		return EXIT_FAILURE;
+	}
+	
+	// header
+	fwrite(RECIPE_BIN_MAGIC, 1, 4, out);
+	FilePutBE32(out, RECIPE_BIN_VERSION);
+	FilePutBE32(out, recipe->count);
+	FilePutBE32(out, RECIPE_BIN_HEADER_SZ + recipe->count * RECIPE_BIN_ITEM_SZ);
+	FilePutBE32(out, 0); // string table size, written last
+	FilePutBE32(out, PATH(recipe->filename));
+	FilePutBE32(out, PATH(recipe->directory));
+	FilePutBE32(out, STRING(recipe->behavior));
+	FilePutBE32(out, PATH(recipe->yarName));
+	FilePutBE32(out, PATH(recipe->imageDir));
+	for (int i = ftell(out); i < RECIPE_BIN_HEADER_SZ; i += 4)
+		FilePutBE32(out, 0);
+	
+	// items
+	for (struct RecipeItem *this = recipe->head; this; this = this->next)
 	{
-		free(this->imageFilename);
-		next = this->next;
-		free(this);
+		if (!strcmp(this->imageFilename, "auto"))
+			FilePutBE32(out, STRING(this->imageFilename));
+		else
+			FilePutBE32(out, PATH(this->imageFilename));
+		FilePutBE32(out, this->width);
+		FilePutBE32(out, this->height);
+		FilePutBE32(out, this->palId);
+		FilePutBE32(out, this->palMaxColors);
+		FilePutBE32(out, this->fmt);
+		FilePutBE32(out, this->bpp);
+		FilePutBE32(out, this->writeAt);
 	}
 	
-	free(recipe->filename);
-	free(recipe->directory);
-	free(recipe->yarName);
-	free(recipe->imageDir);
-	free(recipe->behavior);
+	// strings
+	if (fwrite(strings, 1, sb_count(strings), out) != (size_t)sb_count(strings))
+	{
+		fprintf(stderr, "error writing to file '%s'\n", outfn);
+		fclose(out);
+		sb_free(strings);
+		return EXIT_FAILURE;
+	}
+	fseek(out, 0x10, SEEK_SET);
+	FilePutBE32(out, sb_count(strings));
+	
+	fclose(out);
+	sb_free(strings);
+	return EXIT_SUCCESS;
+	
+	#undef STRING
+	#undef PATH
+}
+
+void RecipeFree(struct Recipe *recipe)
+{
+	if (recipe->stream)
+	{
+		if (recipe->stream->fp)
+			fclose(recipe->stream->fp);
+		free(recipe->stream->imageFilename);
+		free(recipe->stream->buf);
+		free(recipe->stream);
+	}
+	sb_free(recipe->items);
+	ArenaFree(recipe->arena);
 	free(recipe);
 }
 
@@ -185,7 +940,8 @@ void RecipePrint(struct Recipe *recipe)
 	fprintf(stderr, " directory: '%s'\n", recipe->directory);
 	fprintf(stderr, " yarName: '%s'\n", recipe->yarName);
 	fprintf(stderr, " imageDir: '%s'\n", recipe->imageDir);
-	fprintf(stderr, " items:\n");
+	if (recipe->head)
+		fprintf(stderr, " items:\n");
 	
 	for (struct RecipeItem *this = recipe->head; this; this = this->next)
 	{
@@ -196,3 +952,44 @@ void RecipePrint(struct Recipe *recipe)
 	}
 }
 
+
+#ifdef RECIPE_MAIN_BENCH
+
+/* gcc -O2 -DRECIPE_MAIN_BENCH -Iinclude src/recipe.c src/common.c */
+
+#include <time.h>
+
+int main(int argc, char *argv[])
+{
+	const char *fn = argc > 1 ? argv[1] : "recipe_bench.txt";
+	static const char *fmts[] = { "i4", "ia8", "rgba16", "ia16", "i8", "rgba32", "ia4" };
+	int lines = 10000;
+	int runs = 50;
+	FILE *fp = fopen(fn, "w");
+	clock_t start;
+	double ms;
+	
+	if (!fp)
+	{
+		fprintf(stderr, "failed to open '%s' for writing\n", fn);
+		return EXIT_FAILURE;
+	}
+	
+	fprintf(fp, "bench.yar # relative path\nbench/ # where the images live\n");
+	for (int i = 0; i < lines; ++i)
+		fprintf(fp, "%dx%d,%s,texture_%05d.png,%x // 0x%X -- original address\n"
+			, 32 << (i & 1), 16 << (i & 3), fmts[i % 7], i, i * 0x800, i * 0x800
+		);
+	fclose(fp);
+	
+	start = clock();
+	for (int i = 0; i < runs; ++i)
+		RecipeFree(RecipeRead(fn));
+	ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+	
+	fprintf(stderr, "%d lines: %.3f ms per parse (%d runs)\n", lines, ms / runs, runs);
+	remove(fn);
+	
+	return EXIT_SUCCESS;
+}
+#endif /* RECIPE_MAIN_BENCH */
@@ -0,0 +1,352 @@
+/*
+ * scan.c
+ *
+ * 'z64yartool scan', which finds the archives inside a rom
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sys/stat.h> // directory creation
+#include <sys/types.h>
+
+#include "scan.h"
+#include "common.h"
+#include "codec.h"
+#include "libz64yar.h"
+#include "stretchy_buffer.h"
+#include "thread.h"
+
+#define SCAN_ALIGN 4 // archives are word-aligned within the files holding them
+#define SCAN_HEADER_MAX 0x4000 // no archive has more than 4095 entries
+#define ENTRY_HEADER_SZ 0x10 // codec, decompressed size, and two words
+
+struct ScanArchive
+{
+	size_t offset; // within the rom
+	size_t sz;
+	int count;
+	struct z64yar_entry *entries;
+};
+
+/* one thread's share of the rom */
+struct ScanRange
+{
+	const uint8_t *rom;
+	size_t romSz;
+	size_t start;
+	size_t end;
+	struct ScanArchive *found; // stretchy buffer
+};
+
+struct ScanJob
+{
+	const struct ScanArchive *archive;
+	int index;
+	bool failed;
+};
+
+struct ScanPool
+{
+	struct Queue *jobs;
+	const uint8_t *rom;
+	const char *outDir;
+};
+
+// tests whether an archive starts at 'ofs', and describes it if so
+static bool ScanCandidate(const uint8_t *rom, size_t romSz, size_t ofs, struct ScanArchive *archive)
+{
+	const uint8_t *yar = rom + ofs;
+	size_t yarSz = romSz - ofs;
+	const struct z64yar_entry *last;
+	uint32_t headerSz;
+	int count;
+	
+	if (ofs >= romSz || yarSz < 8)
+		return false;
+	
+	// nearly every offset fails these cheap tests: a table length,
+	// a first entry at least as long as its own header, and
+	// compressed data right where the table ends
+	headerSz = U32read(yar);
+	if (headerSz < 8
+		|| (headerSz & 3)
+		|| headerSz > SCAN_HEADER_MAX
+		|| headerSz + ENTRY_HEADER_SZ > yarSz
+		|| U32read(yar + 4) < ENTRY_HEADER_SZ
+		|| !CodecFind(yar + headerSz)
+	)
+		return false;
+	
+	// the rest get the same validation as any other archive
+	if (z64yar_stat(yar, yarSz, 0, 0, &count))
+		return false;
+	
+	archive->entries = malloc(count * sizeof(*archive->entries));
+	assert(archive->entries);
+	z64yar_stat(yar, yarSz, archive->entries, count, &count);
+	last = &archive->entries[count - 1];
+	archive->offset = ofs;
+	archive->count = count;
+	archive->sz = last->offset + last->size;
+	
+	return true;
+}
+
+// where searching resumes after an archive found at 'ofs'
+static size_t ScanSkip(size_t ofs, size_t sz)
+{
+	return ofs + ((sz + SCAN_ALIGN - 1) & ~(size_t)(SCAN_ALIGN - 1));
+}
+
+// searches the offsets from 'ofs' up to 'end', appending any archives
+// to 'found'; returns the offset the search stopped at, which is past
+// 'end' if an archive starting before it runs past it
+static size_t ScanWalk(const uint8_t *rom, size_t romSz, size_t ofs, size_t end, struct ScanArchive **found)
+{
+	struct ScanArchive archive;
+	
+	while (ofs < end)
+	{
+		if (!ScanCandidate(rom, romSz, ofs, &archive))
+		{
+			ofs += SCAN_ALIGN;
+			continue;
+		}
+		
+		// no archive starts inside another one
+		sb_push(*found, archive);
+		ofs = ScanSkip(ofs, archive.sz);
+	}
+	
+	return ofs;
+}
+
+static void *ScanSearch(void *udata)
+{
+	struct ScanRange *range = udata;
+	
+	ScanWalk(range->rom, range->romSz, range->start, range->end, &range->found);
+	
+	return 0;
+}
+
+static void *ScanDumpWorker(void *udata)
+{
+	struct ScanPool *pool = udata;
+	char *fn = malloc(strlen(pool->outDir) + 32);
+	struct ScanJob *job;
+	
+	assert(fn);
+	
+	while ((job = QueuePop(pool->jobs)))
+	{
+		const struct ScanArchive *archive = job->archive;
+		FILE *out;
+		int err;
+		
+		sprintf(fn, "%s/%08lX/%08x.bin"
+			, pool->outDir
+			, (unsigned long)archive->offset
+			, archive->entries[job->index].unyarAddr
+		);
+		if (!(out = fopen(fn, "wb")))
+		{
+			fprintf(stderr, "failed to write file '%s'\n", fn);
+			job->failed = true;
+			continue;
+		}
+		
+		// decoded straight into the file, so large entries needn't fit in memory
+		err = z64yar_extract_stream(pool->rom + archive->offset, archive->sz, job->index, FileWriteSink, out);
+		if (fclose(out) && !err)
+			err = Z64YAR_ERR_SINK;
+		if (err == Z64YAR_ERR_SINK)
+			fprintf(stderr, "failed to write file '%s'\n", fn);
+		else if (err)
+			fprintf(stderr, "%08lX entry %d: %s\n"
+				, (unsigned long)archive->offset, job->index, z64yar_strerror(err)
+			);
+		if (err)
+		{
+			remove(fn);
+			job->failed = true;
+		}
+	}
+	
+	free(fn);
+	return 0;
+}
+
+// decompresses every entry of every archive into outDir
+static int ScanDump(const uint8_t *rom, struct ScanArchive *archives, const char *outDir, int threads)
+{
+	struct ScanPool pool = { .rom = rom, .outDir = outDir };
+	struct Thread **workers = calloc(threads, sizeof(*workers));
+	struct ScanJob *jobs = 0; // stretchy buffer
+	char *dir = malloc(strlen(outDir) + 16);
+	int rval = EXIT_SUCCESS;
+	int i;
+	
+	assert(workers);
+	assert(dir);
+	
+#ifdef _WIN32
+	mkdir(outDir);
+#else
+	mkdir(outDir, 0777);
+#endif
+	for (i = 0; i < sb_count(archives); ++i)
+	{
+		const struct ScanArchive *archive = &archives[i];
+		
+		sprintf(dir, "%s/%08lX", outDir, (unsigned long)archive->offset);
+#ifdef _WIN32
+		mkdir(dir);
+#else
+		mkdir(dir, 0777);
+#endif
+		for (int k = 0; k < archive->count; ++k)
+		{
+			struct ScanJob job = { .archive = archive, .index = k };
+			
+			sb_push(jobs, job);
+		}
+	}
+	
+	// jobs is complete, so pointers into it stay put
+	pool.jobs = QueueNew(sb_count(jobs) + 1);
+	for (i = 0; i < sb_count(jobs); ++i)
+		QueuePush(pool.jobs, &jobs[i]);
+	QueueClose(pool.jobs);
+	for (i = 0; i < threads; ++i)
+		if (!(workers[i] = ThreadNew(ScanDumpWorker, &pool)))
+			ScanDumpWorker(&pool);
+	for (i = 0; i < threads; ++i)
+		ThreadJoin(workers[i]);
+	QueueFree(pool.jobs);
+	
+	for (i = 0; i < sb_count(jobs); ++i)
+		if (jobs[i].failed)
+			rval = EXIT_FAILURE;
+	fprintf(stderr, "wrote %d entries into '%s'\n", sb_count(jobs), outDir);
+	
+	sb_free(jobs);
+	free(workers);
+	free(dir);
+	return rval;
+}
+
+int Scan(const char *romFn, const char *outDir, int threads)
+{
+	size_t romSz;
+	const uint8_t *rom = FileMap(romFn, &romSz);
+	struct ScanRange *ranges;
+	struct Thread **workers;
+	struct ScanArchive *archives = 0; // stretchy buffer
+	size_t share;
+	size_t ofs = 0;
+	int entries = 0;
+	int rval = EXIT_SUCCESS;
+	int i;
+	
+	if (!rom)
+	{
+		fprintf(stderr, "failed to read file '%s'\n", romFn);
+		return EXIT_FAILURE;
+	}
+	
+	ranges = calloc(threads, sizeof(*ranges));
+	workers = calloc(threads, sizeof(*workers));
+	assert(ranges);
+	assert(workers);
+	
+	// search the rom in as many pieces as there are threads
+	share = (romSz / threads + SCAN_ALIGN - 1) & ~(size_t)(SCAN_ALIGN - 1);
+	for (i = 0; i < threads; ++i)
+	{
+		struct ScanRange *range = &ranges[i];
+		
+		range->rom = rom;
+		range->romSz = romSz;
+		range->start = share * i;
+		range->end = i == threads - 1 ? romSz : share * (i + 1);
+		if (!(workers[i] = ThreadNew(ScanSearch, range)))
+			ScanSearch(range);
+	}
+	for (i = 0; i < threads; ++i)
+		ThreadJoin(workers[i]);
+	
+	/* merge the pieces into what a single search would have found;
+	 * 'ofs' is where that search would be, and 'walk' where a piece's
+	 * own search was: a piece can begin inside an archive found by the
+	 * one before it, and whatever it found there is dropped, but then
+	 * it skipped offsets past that archive's end that a single search
+	 * would have tested, so those are searched again here
+	 */
+	for (i = 0; i < threads; ++i)
+	{
+		struct ScanRange *range = &ranges[i];
+		size_t walk = range->start;
+		
+		for (int k = 0; k < sb_count(range->found); ++k)
+		{
+			struct ScanArchive *archive = &range->found[k];
+			
+			ofs = ScanWalk(rom, romSz, ofs, walk, &archives);
+			walk = ScanSkip(archive->offset, archive->sz);
+			if (archive->offset < ofs)
+			{
+				free(archive->entries);
+				continue;
+			}
+			ofs = walk;
+			sb_push(archives, *archive);
+		}
+		ofs = ScanWalk(rom, romSz, ofs, walk, &archives);
+		if (ofs < range->end)
+			ofs = range->end;
+		sb_free(range->found);
+	}
+	
+	// the index
+	for (i = 0; i < sb_count(archives); ++i)
+	{
+		const struct ScanArchive *archive = &archives[i];
+		
+		fprintf(stdout, "%08lX: %d entries, %lu bytes\n"
+			, (unsigned long)archive->offset, archive->count, (unsigned long)archive->sz
+		);
+		for (int k = 0; k < archive->count; ++k)
+		{
+			const struct z64yar_entry *entry = &archive->entries[k];
+			
+			fprintf(stdout, "  entry %3d: %08lX %s %6u -> %6u bytes, %08x.bin\n"
+				, k
+				, (unsigned long)(archive->offset + entry->offset)
+				, entry->codec
+				, entry->size
+				, entry->unyarSize
+				, entry->unyarAddr
+			);
+		}
+		entries += archive->count;
+	}
+	fflush(stdout);
+	fprintf(stderr, "found %d archives holding %d entries\n", sb_count(archives), entries);
+	
+	if (outDir)
+		rval = ScanDump(rom, archives, outDir, threads);
+	
+	for (i = 0; i < sb_count(archives); ++i)
+		free(archives[i].entries);
+	sb_free(archives);
+	free(ranges);
+	free(workers);
+	FileUnmap(rom, romSz);
+	return rval;
+}
@@ -0,0 +1,829 @@
+/*
+ * serve.c
+ *
+ * 'z64yartool serve', which keeps its work warm between requests
+ *
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "serve.h"
+
+#ifdef _WIN32
+
+int Serve(const char *socketPath, int threads)
+{
+	fprintf(stderr, "serve: unix domain sockets are unavailable on this platform\n");
+	return EXIT_FAILURE;
+	
+	(void)socketPath;
+	(void)threads;
+}
+
+#else
+
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h> // directory creation
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "yaz.h"
+#include "image.h"
+#include "recipe.h"
+#include "libz64yar.h"
+#include "n64texconv.h"
+#include "stretchy_buffer.h"
+#include "thread.h"
+
+#define SERVE_REQUEST_MAX 4096
+#define SERVE_ARGS_MAX 16
+#define SERVE_BLOB_BUCKETS 4096 // power of two
+
+// a parsed recipe
+struct CachedRecipe
+{
+	struct CachedRecipe *next;
+	char *filename;
+	struct FileStamp stamp;
+	struct FileStamp srcStamp; // of the text a compiled recipe came from
+	struct Recipe *recipe;
+};
+
+// an archive and its validated index
+struct CachedArchive
+{
+	struct CachedArchive *next;
+	char *filename;
+	struct FileStamp stamp;
+	void *data;
+	size_t dataSz;
+	struct z64yar_entry *entries;
+	int count;
+};
+
+// an image, converted and compressed the way one build asked for
+struct CachedBlob
+{
+	struct CachedBlob *next;
+	char *filename;
+	struct FileStamp stamp;
+	int width;
+	int height;
+	enum n64texconv_fmt fmt;
+	enum n64texconv_bpp bpp;
+	int level;
+	uint8_t *data;
+	unsigned int dataSz;
+};
+
+// an image that needs compressing, handed to the worker threads
+struct ServeJob
+{
+	const struct RecipeItem *item;
+	char *imageFilename; // in the requested format
+	struct FileStamp stamp; // of imageFilename, taken before loading it
+	enum ImageFormat format;
+	int level;
+	struct Event *done;
+	struct CachedBlob *blob; // set once done, 0 on failure
+	const char *errmsg;
+};
+
+struct ServeOptions
+{
+	int level;
+	enum ImageFormat format;
+};
+
+struct Server
+{
+	struct CachedRecipe *recipes;
+	struct CachedArchive *archives;
+	struct CachedBlob *blobs[SERVE_BLOB_BUCKETS];
+	struct Queue *jobs;
+	struct Thread **workers; // stretchy buffer
+};
+
+static uint32_t StringHash(const char *str)
+{
+	uint32_t hash = 2166136261u; // fnv-1a
+	
+	while (*str)
+		hash = (hash ^ (uint8_t)*str++) * 16777619u;
+	
+	return hash;
+}
+
+static void CachedBlobFree(struct CachedBlob *blob)
+{
+	free(blob->filename);
+	free(blob->data);
+	free(blob);
+}
+
+static void CachedArchiveFree(struct CachedArchive *archive)
+{
+	free(archive->filename);
+	free(archive->data);
+	free(archive->entries);
+	free(archive);
+}
+
+// blobs are cached per image and the format it's converted to, since
+// a recipe may use the same image more than once in different formats
+static bool CachedBlobIsFor(const struct CachedBlob *blob, const char *filename, int width, int height, enum n64texconv_fmt fmt, enum n64texconv_bpp bpp)
+{
+	return !strcmp(blob->filename, filename)
+		&& blob->width == width
+		&& blob->height == height
+		&& blob->fmt == fmt
+		&& blob->bpp == bpp
+	;
+}
+
+// the blob of an image that hasn't changed since it was compressed
+static struct CachedBlob *ServeBlobFind(struct Server *server, const struct ServeJob *job)
+{
+	const struct RecipeItem *item = job->item;
+	struct CachedBlob *blob = server->blobs[StringHash(job->imageFilename) & (SERVE_BLOB_BUCKETS - 1)];
+	
+	for ( ; blob; blob = blob->next)
+		if (CachedBlobIsFor(blob, job->imageFilename, item->width, item->height, item->fmt, item->bpp))
+			break;
+	
+	if (blob
+		&& FileStampEqual(&blob->stamp, &job->stamp)
+		&& blob->level == job->level
+	)
+		return blob;
+	
+	return 0;
+}
+
+// takes ownership of a newly compressed blob, replacing any stale one;
+// frees that one, so no job may still be pointing at it
+static void ServeBlobInsert(struct Server *server, struct CachedBlob *blob)
+{
+	struct CachedBlob **link = &server->blobs[StringHash(blob->filename) & (SERVE_BLOB_BUCKETS - 1)];
+	
+	for ( ; *link; link = &(*link)->next)
+	{
+		if (CachedBlobIsFor(*link, blob->filename, blob->width, blob->height, blob->fmt, blob->bpp))
+		{
+			blob->next = (*link)->next;
+			CachedBlobFree(*link);
+			*link = blob;
+			return;
+		}
+	}
+	
+	blob->next = 0;
+	*link = blob;
+}
+
+// loads, converts, and compresses one image
+static void ServeCompress(struct ServeJob *job, void *yazCtx)
+{
+	const struct RecipeItem *this = job->item;
+	struct CachedBlob *blob;
+	int w = this->width;
+	int h = this->height;
+	int channels = n64texconv_gray_channels(this->fmt, this->bpp);
+	unsigned int sz;
+	void *pix;
+	
+	if (!(pix = ImageLoadChannels(job->imageFilename, job->format, &w, &h
+		, channels ? channels : 4, &channels))
+	)
+	{
+		job->errmsg = "failed to load image";
+		return;
+	}
+	
+	if (this->width != w || this->height != h)
+		job->errmsg = "image unexpected dimensions";
+	else if ((job->errmsg = n64texconv_to_n64_from_gray(pix, pix, channels, this->fmt, this->bpp, w, h, &sz)))
+		;
+	else
+	{
+		blob = calloc(1, sizeof(*blob));
+		assert(blob);
+		blob->filename = Strdup(job->imageFilename);
+		blob->stamp = job->stamp;
+		blob->width = w;
+		blob->height = h;
+		blob->fmt = this->fmt;
+		blob->bpp = this->bpp;
+		blob->level = job->level;
+		blob->data = malloc(YAZ_ENCODE_BOUND(sz));
+		assert(blob->data);
+		
+		yazCtx_set_level(yazCtx, job->level);
+		if (yazenc(pix, sz, blob->data, &blob->dataSz, yazCtx))
+		{
+			job->errmsg = "compression error";
+			CachedBlobFree(blob);
+		}
+		else
+			job->blob = blob;
+	}
+	
+	ImageFree(pix);
+}
+
+static void *ServeWorker(void *udata)
+{
+	struct Server *server = udata;
+	void *yazCtx = yazCtx_new();
+	struct ServeJob *job;
+	
+	assert(yazCtx);
+	
+	while ((job = QueuePop(server->jobs)))
+	{
+		ServeCompress(job, yazCtx);
+		EventSet(job->done);
+	}
+	
+	yazCtx_free(yazCtx);
+	
+	return 0;
+}
+
+// returns the recipe, parsing it again only if it has changed
+static struct Recipe *ServeRecipe(struct Server *server, const char *filename)
+{
+	struct CachedRecipe **link = &server->recipes;
+	struct CachedRecipe *this;
+	struct FileStamp stamp;
+	struct FileStamp srcStamp = {0};
+	struct Recipe *recipe;
+	
+	for ( ; *link; link = &(*link)->next)
+		if (!strcmp((*link)->filename, filename))
+			break;
+	
+	if ((this = *link))
+	{
+		if (FileGetStamp(filename, &stamp)
+			&& FileStampEqual(&stamp, &this->stamp)
+			&& FileGetStamp(this->recipe->filename, &srcStamp)
+			&& FileStampEqual(&srcStamp, &this->srcStamp)
+		)
+			return this->recipe;
+		
+		*link = this->next;
+		RecipeFree(this->recipe);
+		free(this->filename);
+		free(this);
+	}
+	
+	if (!FileGetStamp(filename, &stamp) || !(recipe = RecipeLoad(filename)))
+	{
+		fprintf(stderr, "failed to load recipe '%s'\n", filename);
+		return 0;
+	}
+	FileGetStamp(recipe->filename, &srcStamp);
+	
+	this = calloc(1, sizeof(*this));
+	assert(this);
+	this->filename = Strdup(filename);
+	this->stamp = stamp;
+	this->srcStamp = srcStamp;
+	this->recipe = recipe;
+	this->next = server->recipes;
+	server->recipes = this;
+	
+	return recipe;
+}
+
+static void ServeArchiveForget(struct Server *server, const char *filename)
+{
+	for (struct CachedArchive **link = &server->archives; *link; link = &(*link)->next)
+	{
+		if (!strcmp((*link)->filename, filename))
+		{
+			struct CachedArchive *this = *link;
+			
+			*link = this->next;
+			CachedArchiveFree(this);
+			return;
+		}
+	}
+}
+
+// returns the archive, loading and validating it again only if it has changed
+static struct CachedArchive *ServeArchive(struct Server *server, const char *filename)
+{
+	struct CachedArchive *this;
+	struct FileStamp stamp;
+	int err;
+	
+	if (!FileGetStamp(filename, &stamp))
+	{
+		fprintf(stderr, "failed to open archive '%s'\n", filename);
+		return 0;
+	}
+	
+	for (this = server->archives; this; this = this->next)
+		if (!strcmp(this->filename, filename))
+			break;
+	
+	if (this && FileStampEqual(&stamp, &this->stamp))
+		return this;
+	ServeArchiveForget(server, filename);
+	
+	this = calloc(1, sizeof(*this));
+	assert(this);
+	this->filename = Strdup(filename);
+	this->stamp = stamp;
+	if (!(this->data = FileLoad(filename, &this->dataSz)))
+	{
+		fprintf(stderr, "failed to open archive '%s'\n", filename);
+		CachedArchiveFree(this);
+		return 0;
+	}
+	if (!(err = z64yar_stat(this->data, this->dataSz, 0, 0, &this->count)))
+	{
+		this->entries = malloc((this->count + 1) * sizeof(*this->entries));
+		assert(this->entries);
+		z64yar_stat(this->data, this->dataSz, this->entries, this->count, &this->count);
+	}
+	else
+	{
+		fprintf(stderr, "'%s': %s\n", filename, z64yar_strerror(err));
+		CachedArchiveFree(this);
+		return 0;
+	}
+	
+	this->next = server->archives;
+	server->archives = this;
+	
+	return this;
+}
+
+static bool ServeBuild(struct Server *server, struct Recipe *recipe, const struct ServeOptions *opt)
+{
+	struct ServeJob *jobs = 0; // stretchy buffer
+	uint8_t *body = 0; // stretchy buffer
+	uint32_t *ends = 0; // stretchy buffer
+	int compressed = 0;
+	bool ok = true;
+	FILE *out;
+	
+	// allocated up front, since workers hold pointers into it
+	if (recipe->count)
+		memset(sb_add(jobs, recipe->count), 0, recipe->count * sizeof(*jobs));
+	
+	// build in recipe order; the images that changed are compressed
+	// by the workers, while the rest come straight from the cache
+	for (struct RecipeItem *this = recipe->head; this; this = this->next)
+	{
+		struct ServeJob *job = &jobs[this - recipe->head];
+		
+		job->item = this;
+		job->imageFilename = ImageFilename(this->imageFilename, opt->format);
+		job->format = opt->format;
+		job->level = opt->level;
+		
+		if (!FileGetStamp(job->imageFilename, &job->stamp))
+			job->errmsg = "failed to load image";
+		else if (!(job->blob = ServeBlobFind(server, job)))
+		{
+			job->done = EventNew();
+			QueuePush(server->jobs, job);
+			compressed += 1;
+		}
+	}
+	
+	for (int i = 0; i < sb_count(jobs); ++i)
+	{
+		struct ServeJob *job = &jobs[i];
+		
+		if (job->done)
+		{
+			EventWait(job->done);
+			EventFree(job->done);
+		}
+		
+		if (job->errmsg)
+		{
+			fprintf(stderr, "'%s' %s\n", job->imageFilename, job->errmsg);
+			ok = false;
+		}
+		else
+		{
+			memcpy(sb_add(body, (int)job->blob->dataSz), job->blob->data, job->blob->dataSz);
+			while (sb_count(body) & 3)
+				sb_push(body, 0);
+			sb_push(ends, sb_count(body));
+		}
+	}
+	
+	// cache the new blobs only now, as inserting one frees any it
+	// replaces, which a later job may have been using
+	for (int i = 0; i < sb_count(jobs); ++i)
+	{
+		struct ServeJob *job = &jobs[i];
+		
+		if (job->done && job->blob)
+			ServeBlobInsert(server, job->blob);
+		free(job->imageFilename);
+	}
+	sb_free(jobs);
+	
+	// same as YarBuild() writes it, over the existing archive
+	if (ok && !(out = fopen(recipe->yarName, "rb+")))
+	{
+		fprintf(stderr, "failed to open '%s' for writing\n", recipe->yarName);
+		ok = false;
+	}
+	if (ok)
+	{
+		long sz = (sb_count(ends) + 1) * sizeof(uint32_t) + sb_count(body);
+		
+		FilePutBE32(out, (sb_count(ends) + 1) * sizeof(uint32_t));
+		for (int i = 0; i < sb_count(ends); ++i)
+			FilePutBE32(out, ends[i]);
+		if (fwrite(body, 1, sb_count(body), out) != (size_t)sb_count(body))
+			ok = false;
+		for ( ; sz & 15; ++sz)
+			fputc(0, out);
+		if (fclose(out) || !ok)
+		{
+			fprintf(stderr, "error writing to file '%s'\n", recipe->yarName);
+			ok = false;
+		}
+		ServeArchiveForget(server, recipe->yarName);
+		
+		fprintf(stderr, "built '%s': %d entries, %d compressed, %d cached\n"
+			, recipe->yarName, sb_count(ends), compressed, sb_count(ends) - compressed
+		);
+	}
+	
+	sb_free(body);
+	sb_free(ends);
+	return ok;
+}
+
+static bool ServeDump(struct Server *server, struct Recipe *recipe, const struct ServeOptions *opt)
+{
+	struct CachedArchive *archive = ServeArchive(server, recipe->yarName);
+	int i = 0;
+	
+	if (!archive)
+		return false;
+	
+	mkdir(recipe->imageDir, 0777);
+	
+	for (struct RecipeItem *this = recipe->head; this && i < archive->count; this = this->next, ++i)
+	{
+		char *imageFn = ImageFilename(this->imageFilename, opt->format);
+		void *rgba;
+		int err;
+		
+		if ((err = z64yar_dump_rgba(archive->data, archive->dataSz, i
+			, this->fmt, this->bpp, this->width, this->height, &rgba))
+		)
+		{
+			fprintf(stderr, "'%s' %s\n", imageFn, z64yar_strerror(err));
+			free(imageFn);
+			return false;
+		}
+		
+		if (!ImageSave(imageFn, opt->format, this->width, this->height, rgba))
+		{
+			fprintf(stderr, "failed to write image '%s'\n", imageFn);
+			z64yar_free(rgba);
+			free(imageFn);
+			return false;
+		}
+		
+		z64yar_free(rgba);
+		free(imageFn);
+	}
+	
+	fprintf(stderr, "dumped '%s': %d entries\n", recipe->yarName, i);
+	return true;
+}
+
+static bool ServeExtract(struct Server *server, const char *filename, const char *indexStr, const char *outfn)
+{
+	struct CachedArchive *archive = ServeArchive(server, filename);
+	FILE *out;
+	int index;
+	int err;
+	
+	if (!archive)
+		return false;
+	
+	if (sscanf(indexStr, "%d", &index) != 1)
+	{
+		fprintf(stderr, "'%s' is not an entry index\n", indexStr);
+		return false;
+	}
+	
+	if (!(out = fopen(outfn, "wb")))
+	{
+		fprintf(stderr, "failed to write '%s'\n", outfn);
+		return false;
+	}
+	
+	err = z64yar_extract_stream(archive->data, archive->dataSz, index, FileWriteSink, out);
+	if (fclose(out) && !err)
+		err = Z64YAR_ERR_SINK;
+	if (err == Z64YAR_ERR_SINK)
+		fprintf(stderr, "failed to write '%s'\n", outfn);
+	else if (err)
+		fprintf(stderr, "'%s' entry %d: %s\n", filename, index, z64yar_strerror(err));
+	if (err)
+	{
+		remove(outfn);
+		return false;
+	}
+	
+	return true;
+}
+
+// splits a request into whitespace-separated arguments, in-place
+static int ServeRequestSplit(char *request, char *argv[SERVE_ARGS_MAX])
+{
+	int argc = 0;
+	
+	for (char *arg = strtok(request, " \t\r\n"); arg; arg = strtok(0, " \t\r\n"))
+	{
+		if (argc == SERVE_ARGS_MAX)
+			return -1;
+		argv[argc++] = arg;
+	}
+	
+	return argc;
+}
+
+// moves options out of argv like OptionsParse(), returns -1 on error
+static int ServeOptionsParse(int argc, char *argv[], struct ServeOptions *opt)
+{
+	int positional = 0;
+	
+	opt->level = YAZ_LEVEL_DEFAULT;
+	opt->format = IMAGE_FORMAT_PNG;
+	
+	for (int i = 0; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		
+		if (!strcmp(arg, "--level") && i + 1 < argc)
+		{
+			if (!strcmp(argv[++i], "max"))
+				opt->level = YAZ_LEVEL_MAX;
+			else if (sscanf(argv[i], "%d", &opt->level) != 1
+				|| opt->level < 1
+				|| opt->level > YAZ_LEVEL_MAX
+			)
+				return -1;
+		}
+		else if (!strcmp(arg, "--format") && i + 1 < argc)
+		{
+			int format = ImageFormatFind(argv[++i]);
+			
+			if (format < 0)
+				return -1;
+			opt->format = format;
+		}
+		else if (arg[0] == '-')
+			return -1;
+		else
+			argv[positional++] = argv[i];
+	}
+	
+	return positional;
+}
+
+// carries out one request, whose output goes wherever stderr does;
+// returns false on failure, and sets *quit for a quit request
+static bool ServeRequest(struct Server *server, char *request, bool *quit)
+{
+	char *argv[SERVE_ARGS_MAX];
+	struct ServeOptions opt;
+	struct Recipe *recipe;
+	int argc = ServeRequestSplit(request, argv);
+	
+	if (argc > 0)
+		argc = ServeOptionsParse(argc, argv, &opt);
+	
+	if (argc <= 0)
+	{
+		fprintf(stderr, "malformed request\n");
+		return false;
+	}
+	
+	if (!strcmp(argv[0], "quit") && argc == 1)
+	{
+		*quit = true;
+		return true;
+	}
+	else if (!strcmp(argv[0], "extract") && argc == 4)
+		return ServeExtract(server, argv[1], argv[2], argv[3]);
+	else if (!strcmp(argv[0], "build") && argc == 2)
+		return ServerBuild(server, argv[1], opt.level, opt.format);
+	else if (!strcmp(argv[0], "dump") && argc == 2)
+	{
+		if (!(recipe = ServeRecipe(server, argv[1])))
+			return false;
+		
+		if (recipe->behavior[0] == '*')
+		{
+			fprintf(stderr, "retexture recipes aren't served, run 'dump' directly\n");
+			return false;
+		}
+		
+		return ServeDump(server, recipe, &opt);
+	}
+	
+	fprintf(stderr, "unknown or malformed request '%s'\n", argv[0]);
+	return false;
+}
+
+// reads a request line, or as much of one as fits
+static bool ServeRequestRead(int client, char request[SERVE_REQUEST_MAX])
+{
+	int len = 0;
+	
+	while (len < SERVE_REQUEST_MAX - 1)
+	{
+		ssize_t got = read(client, request + len, SERVE_REQUEST_MAX - 1 - len);
+		
+		if (got <= 0)
+			break;
+		len += got;
+		if (memchr(request + len - got, '\n', got))
+			break;
+	}
+	request[len] = '\0';
+	request[strcspn(request, "\n")] = '\0';
+	
+	return len > 0;
+}
+
+struct Server *ServerNew(int threads)
+{
+	struct Server *server = calloc(1, sizeof(*server));
+	
+	assert(server);
+	
+	server->jobs = QueueNew(threads * 2);
+	for (int i = 0; i < threads; ++i)
+	{
+		struct Thread *worker = ThreadNew(ServeWorker, server);
+		
+		if (!worker)
+		{
+			fprintf(stderr, "failed to create worker thread\n");
+			exit(EXIT_FAILURE);
+		}
+		sb_push(server->workers, worker);
+	}
+	
+	return server;
+}
+
+bool ServerBuild(struct Server *server, const char *recipeFn, int level, enum ImageFormat format)
+{
+	struct ServeOptions opt = { .level = level, .format = format };
+	struct Recipe *recipe;
+	
+	if (!(recipe = ServeRecipe(server, recipeFn)))
+		return false;
+	
+	if (recipe->behavior[0] == '*')
+	{
+		fprintf(stderr, "retexture recipes aren't served, run 'build' directly\n");
+		return false;
+	}
+	
+	return ServeBuild(server, recipe, &opt);
+}
+
+void ServerFree(struct Server *server)
+{
+	QueueClose(server->jobs);
+	for (int i = 0; i < sb_count(server->workers); ++i)
+		ThreadJoin(server->workers[i]);
+	sb_free(server->workers);
+	QueueFree(server->jobs);
+	
+	for (struct CachedRecipe *next, *this = server->recipes; this; this = next)
+	{
+		next = this->next;
+		RecipeFree(this->recipe);
+		free(this->filename);
+		free(this);
+	}
+	for (struct CachedArchive *next, *this = server->archives; this; this = next)
+	{
+		next = this->next;
+		CachedArchiveFree(this);
+	}
+	for (int i = 0; i < SERVE_BLOB_BUCKETS; ++i)
+	{
+		for (struct CachedBlob *next, *this = server->blobs[i]; this; this = next)
+		{
+			next = this->next;
+			CachedBlobFree(this);
+		}
+	}
+	
+	free(server);
+}
+
+int Serve(const char *socketPath, int threads)
+{
+	struct Server *server;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	bool quit = false;
+	int listener;
+	int logFd;
+	
+	if (strlen(socketPath) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "socket path '%s' is too long\n", socketPath);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, socketPath);
+	
+	// a server that went away without cleaning up leaves its socket
+	unlink(socketPath);
+	if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+		|| bind(listener, (struct sockaddr*)&addr, sizeof(addr))
+		|| listen(listener, 16)
+	)
+	{
+		fprintf(stderr, "failed to listen on '%s'\n", socketPath);
+		return EXIT_FAILURE;
+	}
+	
+	// clients that hang up early mustn't take the server with them
+	signal(SIGPIPE, SIG_IGN);
+	
+	server = ServerNew(threads);
+	fprintf(stderr, "serving on '%s' with %d threads\n", socketPath, threads);
+	logFd = dup(STDERR_FILENO);
+	assert(logFd >= 0);
+	
+	while (!quit)
+	{
+		char request[SERVE_REQUEST_MAX];
+		char requestCopy[SERVE_REQUEST_MAX];
+		struct timespec start;
+		struct timespec end;
+		int client = accept(listener, 0, 0);
+		bool ok;
+		
+		if (client < 0)
+			continue;
+		
+		if (!ServeRequestRead(client, request))
+		{
+			close(client);
+			continue;
+		}
+		strcpy(requestCopy, request);
+		
+		// everything the request prints goes to the client
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		fflush(stderr);
+		dup2(client, STDERR_FILENO);
+		ok = ServeRequest(server, request, &quit);
+		fprintf(stderr, "%s\n", ok ? "ok" : "error");
+		fflush(stderr);
+		dup2(logFd, STDERR_FILENO);
+		close(client);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		
+		fprintf(stderr, "'%s': %s, %.1f ms\n", requestCopy, ok ? "ok" : "error"
+			, (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0
+		);
+	}
+	
+	close(logFd);
+	close(listener);
+	unlink(socketPath);
+	ServerFree(server);
+	
+	return EXIT_SUCCESS;
+}
+
+#endif /* _WIN32 */
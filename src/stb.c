@@ -1,9 +1,12 @@
-
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #define STBI_ONLY_PNG
+#define STBI_ONLY_BMP
+
+// png deflate goes through image.c, which supports extra levels/backends
+#define STBIW_ZLIB_COMPRESS ImageDeflate
+#include "image.h"
 
 #include "stb_image_write.h"
 #include "stb_image.h"
-
@@ -0,0 +1,18 @@
+/*
+ * stb_deflate.c
+ *
+ * stb_image_write's own deflate, compiled privately so ImageDeflate()
+ * can fall back to it (stb.c replaces it with ImageDeflate())
+ *
+ */
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_STATIC
+#define STBI_WRITE_NO_STDIO
+
+#include "stb_image_write.h"
+
+unsigned char *StbDeflate(unsigned char *data, int dataLen, int *outLen, int quality)
+{
+	return stbi_zlib_compress(data, dataLen, outLen, quality);
+}
@@ -0,0 +1,141 @@
+/*
+ * store.c
+ *
+ * content-addressed store, so identical textures are handled once
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "store.h"
+#include "common.h"
+#include "thread.h"
+
+#define STORE_BUCKETS 4096 // power of two
+
+struct StoreEntry
+{
+	struct StoreEntry *next;
+	uint64_t hash;
+	uint64_t tag;
+	void *data; // a copy of the payload, so equal hashes can be confirmed
+	size_t sz;
+	struct Event *published;
+	void *value;
+	size_t valueSz;
+};
+
+struct Store
+{
+	struct Mutex *lock;
+	struct StoreEntry *buckets[STORE_BUCKETS];
+	int claimed;
+	int unique;
+};
+
+struct Store *StoreNew(void)
+{
+	struct Store *store = calloc(1, sizeof(*store));
+	
+	assert(store);
+	
+	store->lock = MutexNew();
+	
+	return store;
+}
+
+void StoreFree(struct Store *store)
+{
+	if (!store)
+		return;
+	
+	for (int i = 0; i < STORE_BUCKETS; ++i)
+	{
+		struct StoreEntry *next;
+		
+		for (struct StoreEntry *this = store->buckets[i]; this; this = next)
+		{
+			next = this->next;
+			
+			EventFree(this->published);
+			free(this->data);
+			free(this->value);
+			free(this);
+		}
+	}
+	
+	MutexFree(store->lock);
+	free(store);
+}
+
+struct StoreEntry *StoreClaim(struct Store *store, const void *data, size_t sz, uint64_t tag, bool *isNew)
+{
+	uint64_t hash = Hash64(data, sz, tag);
+	struct StoreEntry **bucket = &store->buckets[hash & (STORE_BUCKETS - 1)];
+	struct StoreEntry *entry;
+	
+	MutexLock(store->lock);
+	store->claimed += 1;
+	
+	for (entry = *bucket; entry; entry = entry->next)
+	{
+		if (entry->hash == hash
+			&& entry->tag == tag
+			&& entry->sz == sz
+			&& !memcmp(entry->data, data, sz)
+		)
+		{
+			MutexUnlock(store->lock);
+			*isNew = false;
+			return entry;
+		}
+	}
+	
+	entry = calloc(1, sizeof(*entry));
+	assert(entry);
+	entry->hash = hash;
+	entry->tag = tag;
+	entry->data = malloc(sz + 1);
+	assert(entry->data);
+	memcpy(entry->data, data, sz);
+	entry->sz = sz;
+	entry->published = EventNew();
+	entry->next = *bucket;
+	*bucket = entry;
+	store->unique += 1;
+	
+	MutexUnlock(store->lock);
+	*isNew = true;
+	return entry;
+}
+
+void StorePublish(struct StoreEntry *entry, const void *value, size_t valueSz)
+{
+	entry->value = malloc(valueSz + 1);
+	assert(entry->value);
+	memcpy(entry->value, value, valueSz);
+	entry->valueSz = valueSz;
+	
+	EventSet(entry->published);
+}
+
+const void *StoreWait(struct StoreEntry *entry, size_t *valueSz)
+{
+	EventWait(entry->published);
+	
+	if (valueSz)
+		*valueSz = entry->valueSz;
+	
+	return entry->value;
+}
+
+void StoreGetCounts(struct Store *store, int *claimed, int *unique)
+{
+	MutexLock(store->lock);
+	*claimed = store->claimed;
+	*unique = store->unique;
+	MutexUnlock(store->lock);
+}
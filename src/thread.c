@@ -0,0 +1,229 @@
+/*
+ * thread.c
+ *
+ * threading helpers
+ *
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "thread.h"
+
+struct Queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	void **items; // ring buffer
+	int depth;
+	int head;
+	int count;
+	bool isClosed;
+};
+
+struct Event
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool isSet;
+};
+
+struct Mutex
+{
+	pthread_mutex_t lock;
+};
+
+struct Thread
+{
+	pthread_t id;
+};
+
+struct Queue *QueueNew(int depth)
+{
+	struct Queue *queue = calloc(1, sizeof(*queue));
+	
+	assert(queue);
+	assert(depth > 0);
+	
+	queue->items = calloc(depth, sizeof(*queue->items));
+	assert(queue->items);
+	queue->depth = depth;
+	pthread_mutex_init(&queue->lock, 0);
+	pthread_cond_init(&queue->notEmpty, 0);
+	pthread_cond_init(&queue->notFull, 0);
+	
+	return queue;
+}
+
+void QueuePush(struct Queue *queue, void *item)
+{
+	pthread_mutex_lock(&queue->lock);
+	
+	while (queue->count == queue->depth)
+		pthread_cond_wait(&queue->notFull, &queue->lock);
+	
+	queue->items[(queue->head + queue->count) % queue->depth] = item;
+	queue->count += 1;
+	
+	pthread_cond_signal(&queue->notEmpty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void *QueuePop(struct Queue *queue)
+{
+	void *item = 0;
+	
+	pthread_mutex_lock(&queue->lock);
+	
+	while (!queue->count && !queue->isClosed)
+		pthread_cond_wait(&queue->notEmpty, &queue->lock);
+	
+	if (queue->count)
+	{
+		item = queue->items[queue->head];
+		queue->head = (queue->head + 1) % queue->depth;
+		queue->count -= 1;
+		pthread_cond_signal(&queue->notFull);
+	}
+	
+	pthread_mutex_unlock(&queue->lock);
+	
+	return item;
+}
+
+void QueueClose(struct Queue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->isClosed = true;
+	pthread_cond_broadcast(&queue->notEmpty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void QueueFree(struct Queue *queue)
+{
+	if (!queue)
+		return;
+	
+	pthread_cond_destroy(&queue->notFull);
+	pthread_cond_destroy(&queue->notEmpty);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue->items);
+	free(queue);
+}
+
+struct Event *EventNew(void)
+{
+	struct Event *event = calloc(1, sizeof(*event));
+	
+	assert(event);
+	
+	pthread_mutex_init(&event->lock, 0);
+	pthread_cond_init(&event->cond, 0);
+	
+	return event;
+}
+
+void EventSet(struct Event *event)
+{
+	pthread_mutex_lock(&event->lock);
+	event->isSet = true;
+	pthread_cond_broadcast(&event->cond);
+	pthread_mutex_unlock(&event->lock);
+}
+
+void EventWait(struct Event *event)
+{
+	pthread_mutex_lock(&event->lock);
+	while (!event->isSet)
+		pthread_cond_wait(&event->cond, &event->lock);
+	pthread_mutex_unlock(&event->lock);
+}
+
+void EventFree(struct Event *event)
+{
+	if (!event)
+		return;
+	
+	pthread_cond_destroy(&event->cond);
+	pthread_mutex_destroy(&event->lock);
+	free(event);
+}
+
+struct Mutex *MutexNew(void)
+{
+	struct Mutex *mutex = calloc(1, sizeof(*mutex));
+	
+	assert(mutex);
+	
+	pthread_mutex_init(&mutex->lock, 0);
+	
+	return mutex;
+}
+
+void MutexLock(struct Mutex *mutex)
+{
+	pthread_mutex_lock(&mutex->lock);
+}
+
+void MutexUnlock(struct Mutex *mutex)
+{
+	pthread_mutex_unlock(&mutex->lock);
+}
+
+void MutexFree(struct Mutex *mutex)
+{
+	if (!mutex)
+		return;
+	
+	pthread_mutex_destroy(&mutex->lock);
+	free(mutex);
+}
+
+struct Thread *ThreadNew(void *func(void *udata), void *udata)
+{
+	struct Thread *thread = calloc(1, sizeof(*thread));
+	
+	assert(thread);
+	
+	if (pthread_create(&thread->id, 0, func, udata))
+	{
+		free(thread);
+		return 0;
+	}
+	
+	return thread;
+}
+
+void ThreadJoin(struct Thread *thread)
+{
+	if (!thread)
+		return;
+	
+	pthread_join(thread->id, 0);
+	free(thread);
+}
+
+int ThreadCpuCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	
+	GetSystemInfo(&info);
+	
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	
+	return n > 0 ? n : 1;
+#endif
+}
@@ -0,0 +1,290 @@
+/*
+ * watch.c
+ *
+ * 'z64yartool watch', which rebuilds a recipe as its images are saved
+ *
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "watch.h"
+
+#ifndef __linux__
+
+int Watch(const char *recipeFn, int threads, int level, enum ImageFormat format
+	, int retexture(const char *recipeFn, char **changed, int changedCount, void *udata)
+	, void *udata
+)
+{
+	fprintf(stderr, "watch: inotify is unavailable on this platform\n");
+	return EXIT_FAILURE;
+	
+	(void)recipeFn;
+	(void)threads;
+	(void)level;
+	(void)format;
+	(void)retexture;
+	(void)udata;
+}
+
+#else
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "recipe.h"
+#include "serve.h"
+#include "stretchy_buffer.h"
+
+// how long saves must stop for before rebuilding
+#define WATCH_DEBOUNCE_MS 200
+
+// editors either write files in place or rename new ones over them
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct Watcher
+{
+	const char *recipeFn;
+	const char *recipeName; // recipeFn without its directory
+	enum ImageFormat format;
+	struct Recipe *recipe; // most recent one that loaded
+	char *imageDir;
+	int inotify;
+	int recipeWd;
+	int imageWd;
+	char **changed; // stretchy buffer, images saved since the last rebuild
+	bool recipeChanged;
+};
+
+// (re)loads the recipe, following its image directory if it moved;
+// a recipe that fails to load leaves the previous one in place
+static bool WatcherLoadRecipe(struct Watcher *watcher)
+{
+	struct Recipe *recipe = RecipeLoad(watcher->recipeFn);
+	
+	if (!recipe)
+		return false;
+	
+	if (!watcher->imageDir || strcmp(watcher->imageDir, recipe->imageDir))
+	{
+		int wd = inotify_add_watch(watcher->inotify, recipe->imageDir, WATCH_EVENTS);
+		
+		if (wd < 0)
+		{
+			fprintf(stderr, "failed to watch '%s'\n", recipe->imageDir);
+			RecipeFree(recipe);
+			return false;
+		}
+		if (watcher->imageDir && watcher->imageWd != watcher->recipeWd)
+			inotify_rm_watch(watcher->inotify, watcher->imageWd);
+		free(watcher->imageDir);
+		watcher->imageDir = Strdup(recipe->imageDir);
+		watcher->imageWd = wd;
+	}
+	
+	if (watcher->recipe)
+		RecipeFree(watcher->recipe);
+	watcher->recipe = recipe;
+	
+	return true;
+}
+
+// notes a saved file, if it's the recipe or one of its images
+static void WatcherNote(struct Watcher *watcher, const struct inotify_event *event)
+{
+	char *imageFn;
+	
+	if (!event->len)
+		return;
+	
+	if (event->wd == watcher->recipeWd && !strcmp(event->name, watcher->recipeName))
+	{
+		watcher->recipeChanged = true;
+		return;
+	}
+	
+	if (event->wd != watcher->imageWd)
+		return;
+	
+	imageFn = malloc(strlen(watcher->imageDir) + strlen(event->name) + 1);
+	assert(imageFn);
+	strcpy(imageFn, watcher->imageDir);
+	strcat(imageFn, event->name);
+	
+	for (int i = 0; i < sb_count(watcher->changed); ++i)
+	{
+		if (!strcmp(watcher->changed[i], imageFn))
+		{
+			free(imageFn);
+			return;
+		}
+	}
+	
+	for (struct RecipeItem *this = watcher->recipe->head; this; this = this->next)
+	{
+		char *itemFn = ImageFilename(this->imageFilename, watcher->format);
+		bool isMatch = !strcmp(itemFn, imageFn);
+		
+		free(itemFn);
+		if (isMatch)
+		{
+			sb_push(watcher->changed, imageFn);
+			return;
+		}
+	}
+	
+	free(imageFn);
+}
+
+// runs retexture() in a child process, returns false if it failed
+static bool WatchRetexture(struct Watcher *watcher
+	, int retexture(const char *recipeFn, char **changed, int changedCount, void *udata)
+	, void *udata
+)
+{
+	char **changed = watcher->recipeChanged ? 0 : watcher->changed;
+	int status;
+	pid_t pid;
+	
+	fflush(stderr);
+	if ((pid = fork()) < 0)
+	{
+		fprintf(stderr, "failed to start rebuild\n");
+		return false;
+	}
+	
+	if (!pid)
+		exit(retexture(watcher->recipeFn, changed, sb_count(changed), udata));
+	
+	if (waitpid(pid, &status, 0) != pid)
+		return false;
+	
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+int Watch(const char *recipeFn, int threads, int level, enum ImageFormat format
+	, int retexture(const char *recipeFn, char **changed, int changedCount, void *udata)
+	, void *udata
+)
+{
+	struct Watcher watcher = {
+		.recipeFn = recipeFn
+		, .format = format
+	};
+	struct Server *server = 0;
+	char *recipeDir = FileGetDirectory(recipeFn);
+	
+	watcher.recipeName = recipeFn + strlen(recipeDir);
+	if ((watcher.inotify = inotify_init()) < 0
+		|| (watcher.recipeWd = inotify_add_watch(watcher.inotify, *recipeDir ? recipeDir : ".", WATCH_EVENTS)) < 0
+	)
+	{
+		fprintf(stderr, "failed to watch '%s'\n", recipeFn);
+		return EXIT_FAILURE;
+	}
+	free(recipeDir);
+	
+	if (!WatcherLoadRecipe(&watcher))
+		return EXIT_FAILURE;
+	
+	// archives start with a full build, which warms the cache
+	if (watcher.recipe->behavior[0] != '*')
+	{
+		server = ServerNew(threads);
+		if (!ServerBuild(server, recipeFn, level, format))
+			fprintf(stderr, "build failed, waiting for the next change\n");
+	}
+	
+	fprintf(stderr, "watching '%s' and '%s'\n", recipeFn, watcher.imageDir);
+	
+	for (;;)
+	{
+		// events arrive whole, in a buffer aligned for them
+		union
+		{
+			struct inotify_event event;
+			char data[4096];
+		} events;
+		struct pollfd pfd = { .fd = watcher.inotify, .events = POLLIN };
+		bool isPending = watcher.recipeChanged || sb_count(watcher.changed);
+		struct timespec start;
+		struct timespec end;
+		ssize_t len;
+		bool ok;
+		int ready = poll(&pfd, 1, isPending ? WATCH_DEBOUNCE_MS : -1);
+		
+		if (ready < 0 && errno != EINTR)
+		{
+			fprintf(stderr, "watch error\n");
+			return EXIT_FAILURE;
+		}
+		
+		// still saving, or changes to be noted
+		if (ready > 0)
+		{
+			if ((len = read(watcher.inotify, events.data, sizeof(events.data))) <= 0)
+				continue;
+			
+			for (char *step = events.data; step < events.data + len; )
+			{
+				struct inotify_event *event = (struct inotify_event*)step;
+				
+				WatcherNote(&watcher, event);
+				step += sizeof(*event) + event->len;
+			}
+			continue;
+		}
+		
+		if (!isPending)
+			continue;
+		
+		// the saves have settled, so rebuild
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (watcher.recipeChanged)
+			fprintf(stderr, "'%s' changed\n", recipeFn);
+		for (int i = 0; i < sb_count(watcher.changed); ++i)
+			fprintf(stderr, "'%s' changed\n", watcher.changed[i]);
+		
+		if (watcher.recipeChanged && !WatcherLoadRecipe(&watcher))
+			ok = false;
+		else if (watcher.recipe->behavior[0] == '*')
+			ok = WatchRetexture(&watcher, retexture, udata);
+		else
+		{
+			if (!server)
+				server = ServerNew(threads);
+			ok = ServerBuild(server, recipeFn, level, format);
+		}
+		
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (ok)
+			fprintf(stderr, "rebuilt in %.1f ms\n"
+				, (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0
+			);
+		else
+			fprintf(stderr, "rebuild failed, waiting for the next change\n");
+		
+		for (int i = 0; i < sb_count(watcher.changed); ++i)
+			free(watcher.changed[i]);
+		sb_free(watcher.changed);
+		watcher.changed = 0;
+		watcher.recipeChanged = false;
+	}
+	
+	return EXIT_SUCCESS;
+}
+
+#endif /* __linux__ */
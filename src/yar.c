@@ -7,6 +7,9 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "codec.h"
+#include "thread.h"
+
 #define FERR(x) {         \
    fprintf(stderr, x);    \
    fprintf(stderr, "\n"); \
@@ -399,6 +402,143 @@ int exist(void *src, unsigned srcSz, void *dst, unsigned *dstSz)
 	(void)dstSz;
 }
 
+/* for unyar -j: yar_reencode() lays out the output as usual, but the
+ * files are only noted as it goes, and decoded into place afterwards,
+ * in parallel; every file's place is known from the sizes in the
+ * headers, so the result is the same as decoding them in turn
+ */
+struct deferFile
+{
+	unsigned char *src;
+	unsigned char *dst;
+	unsigned       sz;
+};
+
+struct deferPool
+{
+	struct deferFile *files;
+	int               count;
+	int               next;
+	int               failed;
+	struct Mutex     *lock;
+	const struct Codec *codec;
+};
+
+/* the file is decoded later, by defer_worker() */
+static
+int defer_decode(void *src, void *dst, unsigned dstSz, unsigned *srcSz)
+{
+	return 0;
+	
+	(void)src;
+	(void)dst;
+	(void)dstSz;
+	(void)srcSz;
+}
+
+/* notes where the file goes; files are laid out in header order */
+static
+int defer_encode(void *src, unsigned srcSz, void *dst, unsigned *dstSz, void *ctx)
+{
+	struct deferPool *pool = ctx;
+	
+	pool->files[pool->count].dst = dst;
+	pool->files[pool->count].sz = srcSz;
+	pool->count += 1;
+	*dstSz = srcSz;
+	
+	return 0;
+	
+	(void)src;
+}
+
+static
+void *defer_worker(void *udata)
+{
+	struct deferPool *pool = udata;
+	
+	for (;;)
+	{
+		struct deferFile *file;
+		unsigned unused;
+		
+		MutexLock(pool->lock);
+		file = pool->next < pool->count ? &pool->files[pool->next++] : 0;
+		MutexUnlock(pool->lock);
+		
+		if (!file)
+			break;
+		
+		if (pool->codec->decode(file->src, file->dst, file->sz, &unused))
+		{
+			MutexLock(pool->lock);
+			pool->failed = 1;
+			MutexUnlock(pool->lock);
+		}
+	}
+	
+	return 0;
+}
+
+static
+const char *
+unyar_parallel(
+	unsigned char *raw
+	, unsigned int raw_sz
+	, void *out
+	, unsigned int *out_sz
+	, unsigned int *headerLen
+	, const struct Codec *codec
+	, int threads
+)
+{
+	struct deferPool pool = { .codec = codec };
+	struct Thread **workers;
+	unsigned char imm[16];
+	unsigned int end = u32b(raw);
+	const char *errmsg;
+	int i;
+	
+	/* one file per header word, at most */
+	pool.files = calloc(end / 4 + 1, sizeof(*pool.files));
+	workers = calloc(threads, sizeof(*workers));
+	if (!pool.files || !workers)
+		FERR("memory error");
+	
+	if ((errmsg = yar_reencode(
+		raw, raw_sz, out, out_sz, 16, 0, codec->name, imm, &pool, headerLen
+		, defer_decode
+		, defer_encode
+		, exist
+	)))
+	{
+		free(pool.files);
+		free(workers);
+		return errmsg;
+	}
+	
+	/* file n begins where the header says file n - 1 ends */
+	for (i = 0; i < pool.count; ++i)
+		pool.files[i].src = raw + end + (i ? u32b(raw + i * 4) : 0);
+	
+	pool.lock = MutexNew();
+	for (i = 1; i < threads; ++i)
+		workers[i] = ThreadNew(defer_worker, &pool);
+	defer_worker(&pool);
+	for (i = 1; i < threads; ++i)
+		if (workers[i])
+			ThreadJoin(workers[i]);
+	MutexFree(pool.lock);
+	
+	free(pool.files);
+	free(workers);
+	
+	if (pool.failed)
+		return "decoder error";
+	
+	return 0;
+}
+
 /* unsafe but it's a test program so it's fine */
 static
 unsigned char *
@@ -454,31 +594,46 @@ int savefile(const char *fn, const void *dat, const size_t sz)
 	return 1;
 }
 
-int unyar(const char *infn, const char *outfn, int isHeaderless)
+int unyar(const char *infn, const char *outfn, int isHeaderless, int threads)
 {
 	void *raw;
 	unsigned int raw_sz;
 	
 	void *out;
-	void *imm;
+	void *imm = 0;
 	unsigned int out_sz = 0;
 	unsigned int headerLen = 0;
 	
 	const char *errmsg;
+	const struct Codec *codec;
 	
 	raw = file_read(infn, &raw_sz);
 	fprintf(stderr, "input file %s:\n", infn);
 	
+	/* archives use one codec throughout; detect it from the first file */
+	if (raw_sz < 8
+		|| u32b(raw) + 4 > raw_sz
+		|| !(codec = CodecFind((unsigned char*)raw + u32b(raw)))
+	)
+		FERR("unyar error: unknown codec");
+	
 	/* surely an archive won't exceed 64 MB */
 	out = malloc(1024 * 1024 * 64);
-	imm = malloc(1024 * 1024 * 64);
 	
-	if ((errmsg = yar_reencode(
-		raw, raw_sz, out, &out_sz, 16, infn, "Yaz0", imm, 0, &headerLen
-		, spinout_yaz_dec
-		, encode
-		, exist
-	)))
+	/* only the serial path needs room for a whole decoded entry */
+	if (threads > 1)
+		errmsg = unyar_parallel(raw, raw_sz, out, &out_sz, &headerLen, codec, threads);
+	else if (!(imm = malloc(1024 * 1024 * 64)))
+		errmsg = "memory error";
+	else
+		errmsg = yar_reencode(
+			raw, raw_sz, out, &out_sz, 16, infn, codec->name, imm, 0, &headerLen
+			, codec->decode
+			, encode
+			, exist
+		);
+	
+	if (errmsg)
 	{
 		fprintf(stderr, "unyar error: %s\n", errmsg);
 		exit(EXIT_FAILURE);
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <string.h>
 #include "stretchy_buffer.h"
+#include "thread.h"
+#include "yaz.h"
 
 struct yazCtx
 {
@@ -15,6 +17,10 @@ struct yazCtx
 	uint8_t   *ctl;
 	uint8_t   *back;
 	int       *return_data;
+	int       *matches;     /* precomputed search results, 2 per byte */
+	uint32_t   matches_sz;
+	int        threads;
+	int        level;
 };
 
 void yazCtx_free(void *_ctx)
@@ -25,6 +31,7 @@ void yazCtx_free(void *_ctx)
 		return;
 	
 	free(ctx->return_data);
+	free(ctx->matches);
 	sb_free(ctx->c);
 	sb_free(ctx->raws);
 	sb_free(ctx->ctrl);
@@ -49,10 +56,26 @@ void *yazCtx_new(void)
 	ctx->cmds = sb_add(ctx->cmds, 32);
 	ctx->ctl  = sb_add(ctx->ctl , 32);
 	ctx->back = sb_add(ctx->back, 32);
+	ctx->threads = 1;
+	ctx->level = YAZ_LEVEL_DEFAULT;
 	
 	return ctx;
 }
 
+void yazCtx_set_level(void *_ctx, int level)
+{
+	struct yazCtx *ctx = _ctx;
+	
+	ctx->level = level;
+}
+
+void yazCtx_set_threads(void *_ctx, int threads)
+{
+	struct yazCtx *ctx = _ctx;
+	
+	ctx->threads = threads > 1 ? threads : 1;
+}
+
 // MIO0 encoding
 #define MIx 0
 
@@ -197,10 +220,201 @@ static int *_enc_search(struct yazCtx *ctx, uint8_t *data, int pos, uint32_t sz,
 	return return_data;
 }
 
+/* the longest match at each position depends only on the input, so
+ * large inputs are split into slices that are parsed speculatively
+ * in parallel, each as though encoding began at the start of its
+ * slice (with the preceding 0x1000 byte window available); every
+ * search result is recorded in a table, and since parses starting
+ * at different positions quickly converge onto the same path, the
+ * sequential pass in encode() then finds nearly every search it
+ * needs already done, and makes the same decisions it always would
+ */
+struct _enc_match_job {
+	uint8_t *data;
+	uint32_t sz;
+	uint32_t cap;
+	int *matches;
+	int slice;
+	int slices;
+	int stride;
+	int all;
+};
+
+#define MATCH_SLICE 0x4000
+
+static inline int *_enc_match_get(struct yazCtx *ctx, int *matches, uint8_t *data, uint32_t pos, uint32_t sz, uint32_t cap) {
+	int *m = matches + pos * 2;
+	if (m[1] < 0) {
+		int *r = _enc_search(ctx, data, pos, sz, cap);
+		m[0] = r[0];
+		m[1] = r[1];
+	}
+	return m;
+}
+
+static void *_enc_match_slices(void *udata) {
+	struct _enc_match_job *job = udata;
+	struct yazCtx local;
+	int return_data[2];
+	int s;
+	
+	local.return_data = return_data;
+	
+	/* slices are interleaved between threads to balance the load */
+	for (s = job->slice; s < job->slices; s += job->stride) {
+		uint32_t pos = s * MATCH_SLICE;
+		uint32_t end = min(pos + MATCH_SLICE, job->sz);
+		/* every position */
+		if (job->all) {
+			for (; pos < end; ++pos)
+				_enc_match_get(&local, job->matches, job->data, pos, job->sz, job->cap);
+			continue;
+		}
+		/* same decisions as encode() */
+		while (pos < end) {
+			int hitl = _enc_match_get(&local, job->matches, job->data, pos, job->sz, job->cap)[1];
+			if (hitl < 3) {
+				pos += 1;
+				continue;
+			}
+			/* the next slice owns the entry at its start */
+			int tstl = (pos + 1 < end)
+				? _enc_match_get(&local, job->matches, job->data, pos + 1, job->sz, job->cap)[1]
+				: _enc_search(&local, job->data, pos + 1, job->sz, job->cap)[1];
+			if ((hitl + 1) < tstl) {
+				pos += 1;
+				hitl = tstl;
+			}
+			pos += hitl;
+		}
+	}
+	return 0;
+}
+
+static int *_enc_match_table(struct yazCtx *ctx, uint8_t *data, uint32_t sz, uint32_t cap, int all) {
+	struct _enc_match_job *jobs;
+	struct Thread **threads;
+	int slices = (sz + MATCH_SLICE - 1) / MATCH_SLICE;
+	int n = min(ctx->threads, slices);
+	int i;
+	
+	/* one entry per position, plus one past the end */
+	if (ctx->matches_sz < sz + 1) {
+		free(ctx->matches);
+		ctx->matches_sz = sz + 1;
+		if (!(ctx->matches = malloc(ctx->matches_sz * 2 * sizeof(*ctx->matches)))) {
+			ctx->matches_sz = 0;
+			return 0;
+		}
+	}
+	
+	/* mark every entry as not yet searched */
+	memset(ctx->matches, 0xff, (sz + 1) * 2 * sizeof(*ctx->matches));
+	
+	jobs = calloc(n, sizeof(*jobs));
+	threads = calloc(n, sizeof(*threads));
+	if (!jobs || !threads) {
+		free(jobs);
+		free(threads);
+		return 0;
+	}
+	for (i = 0; i < n; ++i) {
+		jobs[i].data = data;
+		jobs[i].sz = sz;
+		jobs[i].cap = cap;
+		jobs[i].matches = ctx->matches;
+		jobs[i].slice = i;
+		jobs[i].slices = slices;
+		jobs[i].stride = n;
+		jobs[i].all = all;
+		
+		/* the calling thread takes the first share */
+		if (i)
+			threads[i] = ThreadNew(_enc_match_slices, &jobs[i]);
+		
+		/* couldn't create thread, do it here */
+		if (i && !threads[i])
+			_enc_match_slices(&jobs[i]);
+	}
+	_enc_match_slices(&jobs[0]);
+	for (i = 1; i < n; ++i)
+		ThreadJoin(threads[i]);
+	
+	free(jobs);
+	free(threads);
+	return ctx->matches;
+}
+
+/* YAZ_LEVEL_MAX: with the longest match at every position known, the
+ * cheapest sequence of raws and copies (measured in bits, including
+ * control bits) is found by working backwards from the end of the data;
+ * returns 0 on failure, otherwise the flag following the final command
+ */
+static uint32_t _enc_parse_optimal(struct yazCtx *ctx, uint8_t *data, uint32_t sz, uint32_t cap, int *matches) {
+	uint32_t *cost = malloc((sz + 1) * sizeof(*cost));
+	uint16_t *len = malloc(sz * sizeof(*len));
+	uint32_t flag = 0x80000000;
+	uint32_t pos;
+	
+	if (!cost || !len) {
+		free(cost);
+		free(len);
+		return 0;
+	}
+	
+	cost[sz] = 0;
+	for (pos = sz; pos-- > 0; ) {
+		uint32_t best = cost[pos + 1] + 9; /* raw */
+		int bestl = 1;
+		int l;
+		for (l = matches[pos * 2 + 1]; l >= 3; --l) {
+			/* MIx copies are always 2 bytes, Yax copies 3 bytes past 0x11 */
+			uint32_t c = cost[pos + l] + ((cap == 0x12 || l < 0x12) ? 17 : 25);
+			if (c < best) {
+				best = c;
+				bestl = l;
+			}
+		}
+		cost[pos] = best;
+		len[pos] = bestl;
+	}
+	
+	for (pos = 0; pos < sz; ) {
+		int hitl = len[pos];
+		if (hitl == 1) {
+			sb_push(ctx->raws, data[pos]);
+			ctx->cmds[sb_count(ctx->cmds)-1] |= flag;
+			pos += 1;
+		} else {
+			int e = pos - matches[pos * 2] - 1;
+			pos += hitl;
+			if (cap == 0x12) {
+				hitl -= 3;
+				sb_push(ctx->ctrl, (hitl<<12) | e);
+			} else if (hitl < 0x12) {
+				hitl -= 2;
+				sb_push(ctx->ctrl, (hitl<<12)|e);
+			} else {
+				sb_push(ctx->ctrl, e);
+				sb_push(ctx->raws, hitl - 0x12);
+			}
+		}
+		flag >>= 1;
+		if (flag == 0) {
+			flag = 0x80000000;
+			sb_push(ctx->cmds, 0);
+		}
+	}
+	
+	free(cost);
+	free(len);
+	return flag;
+}
+
 static
 uint32_t encode(struct yazCtx *ctx, uint8_t *data, uint32_t data_size, uint8_t *output, const char *mode) {
 	uint32_t
-		cap=0x111,
+		cap=strcmp(mode,"MIO0") ? 0x111 : 0x12,
 		sz=data_size,
 		pos=0,
 		flag=0x80000000
@@ -219,8 +433,23 @@ uint32_t encode(struct yazCtx *ctx, uint8_t *data, uint32_t data_size, uint8_t *
 			output[i]=0x00;
 		return 16;
 	}
+	
+	/* precompute search results (in parallel, if enabled) */
+	int *matches = 0;
+	int is_max = ctx->level >= YAZ_LEVEL_MAX;
+	if (is_max || (ctx->threads > 1 && data_size >= YAZ_PARALLEL_MIN))
+		matches = _enc_match_table(ctx, data, data_size, cap, is_max);
+	#define SEARCH(POS) (matches \
+		? _enc_match_get(ctx, matches, data, POS, sz, cap) \
+		: _enc_search(ctx, data, POS, sz, cap))
+	
+	if (is_max && matches && (flag = _enc_parse_optimal(ctx, data, sz, cap, matches)))
+		pos = sz;
+	else
+		flag = 0x80000000;
+	
 	while(pos<sz) {
-		int *search_return = _enc_search(ctx, data, pos, sz, cap);
+		int *search_return = SEARCH(pos);
 		
 		int hitp = search_return[0];
 		int hitl = search_return[1];
@@ -231,7 +460,7 @@ uint32_t encode(struct yazCtx *ctx, uint8_t *data, uint32_t data_size, uint8_t *
 			ctx->cmds[sb_count(ctx->cmds)-1] |= flag;
 			pos += 1;
 		} else {
-			search_return = _enc_search(ctx, data, pos+1, sz, cap);
+			search_return = SEARCH(pos+1);
 			int tstp = search_return[0];
 			int tstl = search_return[1];
 			
@@ -269,6 +498,8 @@ uint32_t encode(struct yazCtx *ctx, uint8_t *data, uint32_t data_size, uint8_t *
 		}
 	}
 	
+	#undef SEARCH
+	
 	// if no cmds in final word, delete it
 	if (flag == 0x80000000) {
 		stb__sbn(ctx->cmds) -= 1;//cmds.erase(cmds.end()-1);
@@ -278,7 +509,7 @@ uint32_t encode(struct yazCtx *ctx, uint8_t *data, uint32_t data_size, uint8_t *
 	// Yay is block, Yaz is stream
 	int mode_block=1, mode_stream=1; // temporary, for testing
 	const int g_hlen = 8;
-	mode_block=!strcmp(mode,"Yay0");
+	mode_block=!strcmp(mode,"Yay0") || !strcmp(mode,"MIO0");
 	if (g_hlen) {
 		memcpy(output, mode, 4);
 		U32wr(output+4, sz);
@@ -338,6 +569,24 @@ yazenc(void *_src, unsigned src_sz, void *_dst, unsigned *dst_sz, void *_ctx)
 	return 0;
 }
 
+int
+yayenc(void *_src, unsigned src_sz, void *_dst, unsigned *dst_sz, void *_ctx)
+{
+	if (!_ctx)
+		return 1;
+	*dst_sz = encode(_ctx, _src, src_sz, _dst, "Yay0");
+	return 0;
+}
+
+int
+mioenc(void *_src, unsigned src_sz, void *_dst, unsigned *dst_sz, void *_ctx)
+{
+	if (!_ctx)
+		return 1;
+	*dst_sz = encode(_ctx, _src, src_sz, _dst, "MIO0");
+	return 0;
+}
+
 /* yaz decoder, courtesy of spinout182 */
 int
 yazdec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
@@ -350,6 +599,9 @@ yazdec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
 	unsigned int validBitCount = 0; /*number of valid bits left in "code" byte*/
 	unsigned char currCodeByte = 0;
 	
+	if (dstSz == 0)
+		dstSz = U32b(src + 4);
+	
 	int uncompressedSize = dstSz;
 	
 	src += 0x10;
@@ -362,6 +614,16 @@ yazdec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
 			currCodeByte = src[srcPlace];
 			++srcPlace;
 			validBitCount = 8;
+			
+			/*eight direct copies in a row are done at once*/
+			if(currCodeByte == 0xFF && uncompressedSize - dstPlace >= 8)
+			{
+				memcpy(dst + dstPlace, src + srcPlace, 8);
+				dstPlace += 8;
+				srcPlace += 8;
+				validBitCount = 0;
+				continue;
+			}
 		}
 		
 		if(currCodeByte & 0x80)
@@ -390,6 +652,11 @@ yazdec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
 				srcPlace++;
 			}
 
+			/*malformed data mustn't reach outside of dst*/
+			if (dist + 1 > (unsigned)dstPlace)
+				return 1;
+			numBytes = min(numBytes, (unsigned)(uncompressedSize - dstPlace));
+
 			/*copy run*/
 			for(unsigned int i = 0; i < numBytes; ++i)
 			{
@@ -410,6 +677,373 @@ yazdec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
 	return 0;
 }
 
+/* copies a back-reference; non-overlapping runs are copied at once */
+static inline void _dec_copy(uint8_t *dst, uint32_t dist, uint32_t n) {
+	uint8_t *s = dst - dist;
+	if (dist >= n)
+		memcpy(dst, s, n);
+	else
+		while (n--)
+			*dst++ = *s++;
+}
+
+/* Yay0 and MIO0 keep control bits, back-references, and raw bytes in
+ * three separate tables, whose offsets are stored in the header; they
+ * differ only in how copy lengths are encoded (MIO0 has no long form)
+ */
+static int _dec_block(uint8_t *src, uint8_t *dst, uint32_t dstSz, unsigned *srcSz, int isMIO0) {
+	uint8_t *ctl = src + 0x10;
+	uint8_t *links = src + U32b(src + 8);
+	uint8_t *chunks = src + U32b(src + 12);
+	uint32_t bits = 0;
+	uint32_t pos = 0;
+	int count = 0;
+	
+	if (dstSz == 0)
+		dstSz = U32b(src + 4);
+	
+	while (pos < dstSz) {
+		if (!count) {
+			bits = (uint32_t)ctl[0] << 24 | ctl[1] << 16 | ctl[2] << 8 | ctl[3];
+			ctl += 4;
+			count = 32;
+		}
+		if (bits & 0x80000000)
+			dst[pos++] = *chunks++;
+		else {
+			uint32_t link = U16b(links);
+			uint32_t dist = (link & 0xfff) + 1;
+			uint32_t n = link >> 12;
+			links += 2;
+			if (isMIO0)
+				n += 3;
+			else if (n)
+				n += 2;
+			else
+				n = *chunks++ + 0x12;
+			if (dist > pos)
+				return 1;
+			n = min(n, dstSz - pos);
+			_dec_copy(dst + pos, dist, n);
+			pos += n;
+		}
+		bits <<= 1;
+		count -= 1;
+	}
+	
+	if (srcSz)
+		*srcSz = chunks - src;
+	
+	return 0;
+}
+
+int
+yaydec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
+{
+	return _dec_block(_src, _dst, dstSz, srcSz, 0);
+}
+
+int
+miodec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
+{
+	return _dec_block(_src, _dst, dstSz, srcSz, 1);
+}
+
+#define YAZ_WINDOW 0x1000 /* as far back as a Yaz0 copy reaches */
+
+struct yazStream
+{
+	uint8_t    window[YAZ_WINDOW]; /* the last 4 KiB written */
+	uint8_t    header[0x10];
+	uint8_t    op[3];              /* a back-reference, as it arrives */
+	unsigned   headerSz;
+	unsigned   opSz;
+	uint32_t   size;               /* decompressed size, from the header */
+	uint32_t   pos;                /* bytes written so far */
+	uint32_t   copyDist;
+	uint32_t   copyLeft;           /* of a run not yet written */
+	unsigned   validBitCount;
+	uint8_t    currCodeByte;
+};
+
+void *yazStream_new(void)
+{
+	return calloc(1, sizeof(struct yazStream));
+}
+
+void yazStream_free(void *_stream)
+{
+	free(_stream);
+}
+
+unsigned yazStream_size(void *_stream)
+{
+	struct yazStream *s = _stream;
+	
+	return s->headerSz == sizeof(s->header) ? s->size : 0;
+}
+
+/* same decoding as yazdec(), but every loop can stop for want of input
+ * or output, and picks up where it left off on the next call
+ */
+int yazStream_dec(void *_stream, const void *_src, unsigned srcSz, unsigned *srcUsed, void *_dst, unsigned dstSz, unsigned *dstUsed)
+{
+	struct yazStream *s = _stream;
+	const uint8_t *src = _src;
+	uint8_t *dst = _dst;
+	unsigned i = 0;
+	unsigned o = 0;
+	int rval = YAZ_STREAM_OK;
+	
+	while (s->headerSz < sizeof(s->header) && i < srcSz)
+	{
+		s->header[s->headerSz++] = src[i++];
+		if (s->headerSz == sizeof(s->header))
+			s->size = U32b(s->header + 4);
+	}
+	if (s->headerSz == sizeof(s->header) && memcmp(s->header, "Yaz0", 4))
+		rval = YAZ_STREAM_ERROR;
+	
+	while (rval == YAZ_STREAM_OK && s->headerSz == sizeof(s->header))
+	{
+		/* finish the current run first */
+		while (s->copyLeft && o < dstSz)
+		{
+			uint8_t b = s->window[(s->pos - s->copyDist) & (YAZ_WINDOW - 1)];
+			
+			s->window[s->pos & (YAZ_WINDOW - 1)] = b;
+			dst[o++] = b;
+			s->pos++;
+			s->copyLeft--;
+		}
+		
+		if (s->pos == s->size)
+		{
+			rval = YAZ_STREAM_END;
+			break;
+		}
+		if (o == dstSz)
+			break;
+		
+		if (!s->validBitCount)
+		{
+			if (i == srcSz)
+				break;
+			s->currCodeByte = src[i++];
+			s->validBitCount = 8;
+		}
+		
+		if (s->currCodeByte & 0x80)
+		{
+			/* direct copy */
+			if (i == srcSz)
+				break;
+			s->window[s->pos & (YAZ_WINDOW - 1)] = src[i];
+			dst[o++] = src[i++];
+			s->pos++;
+		}
+		else
+		{
+			/* back-reference, two bytes, or three for long runs */
+			while (s->opSz < 2 && i < srcSz)
+				s->op[s->opSz++] = src[i++];
+			if (s->opSz == 2 && !(s->op[0] >> 4) && i < srcSz)
+				s->op[s->opSz++] = src[i++];
+			if (s->opSz < 2 || (s->opSz == 2 && !(s->op[0] >> 4)))
+				break;
+			
+			s->copyDist = (((s->op[0] & 0xF) << 8) | s->op[1]) + 1;
+			if (s->op[0] >> 4)
+				s->copyLeft = (s->op[0] >> 4) + 2;
+			else
+				s->copyLeft = s->op[2] + 0x12;
+			s->opSz = 0;
+			
+			/* malformed data mustn't reach before the start */
+			if (s->copyDist > s->pos)
+			{
+				rval = YAZ_STREAM_ERROR;
+				break;
+			}
+			s->copyLeft = min(s->copyLeft, s->size - s->pos);
+		}
+		
+		s->currCodeByte <<= 1;
+		s->validBitCount -= 1;
+	}
+	
+	if (srcUsed)
+		*srcUsed = i;
+	if (dstUsed)
+		*dstUsed = o;
+	
+	return rval;
+}
+
+#define YAZ_LOOKAHEAD (0x111 + 1) /* the longest copy, searched from pos + 1 */
+#define YAZ_ENC_BUF   0x4000    /* window and lookahead, with room to refill */
+
+struct yazEncStream
+{
+	uint8_t    data[YAZ_ENC_BUF];  /* input, from offset 'base' onwards */
+	uint8_t    group[1 + 8 * 3];   /* control byte, then up to 8 commands */
+	uint8_t    out[1 + 8 * 3];     /* the header, or a finished group */
+	struct yazCtx ctx;             /* only for _enc_search() */
+	int        return_data[2];
+	unsigned   groupSz;
+	unsigned   groupOps;
+	unsigned   outSz;              /* bytes of 'out' not yet written */
+	unsigned   outPos;
+	uint32_t   size;               /* total input */
+	uint32_t   base;
+	uint32_t   end;                /* input received */
+	uint32_t   pos;                /* input encoded */
+};
+
+void *yazEncStream_new(unsigned srcSz)
+{
+	struct yazEncStream *s = calloc(1, sizeof(*s));
+	
+	if (!s)
+		return 0;
+	
+	s->ctx.return_data = s->return_data;
+	s->size = srcSz;
+	
+	/* the header goes out first */
+	memcpy(s->out, "Yaz0", 4);
+	U32wr(s->out + 4, srcSz);
+	s->outSz = 0x10;
+	
+	return s;
+}
+
+void yazEncStream_free(void *_stream)
+{
+	free(_stream);
+}
+
+/* a finished group is moved out to be written */
+static void _enc_stream_group_end(struct yazEncStream *s) {
+	memcpy(s->out + s->outSz, s->group, s->groupSz);
+	s->outSz += s->groupSz;
+	s->groupSz = 0;
+	s->groupOps = 0;
+}
+
+static void _enc_stream_raw(struct yazEncStream *s, uint8_t b) {
+	if (!s->groupSz)
+		s->group[s->groupSz++] = 0;
+	s->group[0] |= 0x80 >> s->groupOps;
+	s->group[s->groupSz++] = b;
+	if (++s->groupOps == 8)
+		_enc_stream_group_end(s);
+}
+
+static void _enc_stream_copy(struct yazEncStream *s, int e, int hitl) {
+	if (!s->groupSz)
+		s->group[s->groupSz++] = 0;
+	if (hitl < 0x12) {
+		s->group[s->groupSz++] = ((hitl - 2) << 4) | (e >> 8);
+		s->group[s->groupSz++] = e;
+	} else {
+		s->group[s->groupSz++] = e >> 8;
+		s->group[s->groupSz++] = e;
+		s->group[s->groupSz++] = hitl - 0x12;
+	}
+	if (++s->groupOps == 8)
+		_enc_stream_group_end(s);
+}
+
+/* one step of encode()'s greedy loop, on positions relative to 'base';
+ * the window and lookahead it searches are always resident, so its
+ * searches return just what they would on the whole input
+ */
+static void _enc_stream_step(struct yazEncStream *s) {
+	uint32_t pos = s->pos - s->base;
+	uint32_t sz = s->end - s->base;
+	int *search_return = _enc_search(&s->ctx, s->data, pos, sz, 0x111);
+	int hitp = search_return[0];
+	int hitl = search_return[1];
+	
+	if (hitl < 3) {
+		_enc_stream_raw(s, s->data[pos]);
+		s->pos += 1;
+		return;
+	}
+	
+	search_return = _enc_search(&s->ctx, s->data, pos + 1, sz, 0x111);
+	if ((hitl + 1) < search_return[1]) {
+		_enc_stream_raw(s, s->data[pos]);
+		pos += 1;
+		hitp = search_return[0];
+		hitl = search_return[1];
+	}
+	_enc_stream_copy(s, pos - hitp - 1, hitl);
+	s->pos = s->base + pos + hitl;
+}
+
+int yazEncStream_enc(void *_stream, const void *_src, unsigned srcSz, unsigned *srcUsed, void *_dst, unsigned dstSz, unsigned *dstUsed)
+{
+	struct yazEncStream *s = _stream;
+	const uint8_t *src = _src;
+	uint8_t *dst = _dst;
+	unsigned i = 0;
+	unsigned o = 0;
+	int rval = YAZ_STREAM_OK;
+	
+	for (;;)
+	{
+		/* what's finished is written before anything more is encoded */
+		unsigned n = min(s->outSz - s->outPos, dstSz - o);
+		memcpy(dst + o, s->out + s->outPos, n);
+		o += n;
+		s->outPos += n;
+		if (s->outPos < s->outSz)
+			break;
+		s->outSz = s->outPos = 0;
+		
+		if (s->pos == s->size)
+		{
+			if (!s->groupSz)
+			{
+				rval = YAZ_STREAM_END;
+				break;
+			}
+			_enc_stream_group_end(s);
+			continue;
+		}
+		
+		/* take in as much input as fits */
+		n = min(min(s->size - s->end, YAZ_ENC_BUF - (s->end - s->base)), srcSz - i);
+		memcpy(s->data + (s->end - s->base), src + i, n);
+		s->end += n;
+		i += n;
+		
+		/* a step needs the full lookahead, unless the input ends sooner */
+		if (s->end < s->size && s->end - s->pos < YAZ_LOOKAHEAD)
+		{
+			/* keep the window, and make room after it */
+			uint32_t base = s->pos > 0x1000 ? s->pos - 0x1000 : 0;
+			
+			if (s->end - s->base < YAZ_ENC_BUF || base == s->base)
+				break;
+			memmove(s->data, s->data + (base - s->base), s->end - base);
+			s->base = base;
+			continue;
+		}
+		
+		_enc_stream_step(s);
+	}
+	
+	if (srcUsed)
+		*srcUsed = i;
+	if (dstUsed)
+		*dstUsed = o;
+	
+	return rval;
+}
+
 #ifdef YAZ_MAIN_TEST
 
 #define FERR(x) {         \
@@ -420,9 +1054,14 @@ yazdec(void *_src, void *_dst, unsigned dstSz, unsigned *srcSz)
 
 int main(int argc, char* argv[])
 {
+	static uint8_t inbuf[0x10000];
+	static uint8_t outbuf[0x10000];
 	FILE *fp;
-	struct yazCtx *ctx;
+	void *stream;
 	unsigned size;
+	unsigned inSz = 0;
+	unsigned inPos = 0;
+	int rval = YAZ_STREAM_OK;
 	
 	if(argc < 2)
 		FERR("args: yazenc in.raw > out.yaz");
@@ -437,24 +1076,34 @@ int main(int argc, char* argv[])
 	
 	fprintf(stderr, "input file size: %d\n", size);
 	
-	void *buf = malloc(size);
-	void *outbuf = malloc( (size + 64) * 2);
+	/* encoded a piece at a time, so files of any size fit in memory */
+	if (!(stream = yazEncStream_new(size)))
+		FERR("out of memory");
 	
-	if (fread(buf, 1, size, fp) != size)
-		FERR("failed to read file");
+	while (rval == YAZ_STREAM_OK)
+	{
+		unsigned used;
+		unsigned outSz;
+		
+		if (inPos == inSz)
+		{
+			inSz = fread(inbuf, 1, sizeof(inbuf), fp);
+			inPos = 0;
+		}
+		
+		rval = yazEncStream_enc(stream, inbuf + inPos, inSz - inPos, &used, outbuf, sizeof(outbuf), &outSz);
+		inPos += used;
+		
+		if (fwrite(outbuf, 1, outSz, stdout) != outSz)
+			FERR("failed to write stdout");
+		
+		/* the file ended before the size it had at the start */
+		if (rval == YAZ_STREAM_OK && !inSz && !outSz)
+			FERR("failed to read file");
+	}
 	
 	fclose(fp);
-	
-	ctx = yazCtx_new();
-	if (yazenc(buf, size, outbuf, &size, ctx))
-		FERR("encoding error");
-	
-	if (fwrite(outbuf, 1, size, stdout) != size)
-		FERR("failed to write stdout");
-	
-	yazCtx_free(ctx);
-	free(buf);
-	free(outbuf);
+	yazEncStream_free(stream);
 	return EXIT_SUCCESS;
 }
 #endif /* YAZ_MAIN_TEST */
@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <sys/stat.h> // directory creation
 #include <sys/types.h>
@@ -17,16 +18,42 @@
 #include "common.h"
 #include "yar.h" // from z64compress
 #include "yaz.h" // from z64compress
+#include "codec.h"
+#include "libz64yar.h"
+#include "manifest.h"
+#include "image.h"
 #include "n64texconv.h" // from z64convert
 #include "recipe.h"
+#include "scan.h"
+#include "serve.h"
+#include "store.h"
+#include "watch.h"
 #include "stb_image_write.h"
 #include "stb_image.h"
 #include "exoquant.h"
+#include "stretchy_buffer.h"
+#include "thread.h"
+
+struct Options
+{
+	int threads; // -j
+	int queueDepth; // --queue-depth
+	int level; // --level
+	bool fit; // --fit
+	bool manifest; // --manifest
+	const struct Codec *codec; // --codec, 0 = keep each entry's own
+	enum ImageFormat format; // --format
+	int pngLevel; // --png-level
+	int pngFilter; // --png-filter
+	const char *socket; // --socket
+};
 
 struct YarEntry
 {
 	struct YarEntry *next;
 	void *data;
+	const struct Codec *codec;
+	unsigned int dataSz; // compressed size, including alignment
 	unsigned int dataAddrUnyar; // where data will live in unyar'd file
 };
 
@@ -42,19 +69,28 @@ struct Yar *YarRead(const char *filename)
 {
 	struct Yar *yar = calloc(1, sizeof(*yar));
 	struct YarEntry *prev = 0;
-	uint8_t *body;
-	uint8_t *stepHeader;
-	unsigned int dataAddrUnyar = 0;
+	struct z64yar_entry *entries;
+	int err;
 	
 	assert(yar);
 	
 	if (!(yar->data = FileLoad(filename, &yar->dataSz)))
+	{
+		free(yar);
 		return 0;
-		
-	stepHeader = yar->data;
-	body = stepHeader + U32read(yar->data);
+	}
 	
-	yar->count = (U32read(yar->data) / sizeof(uint32_t)) - 1;
+	// the library validates the archive before anything trusts it
+	if ((err = z64yar_stat(yar->data, yar->dataSz, 0, 0, &yar->count)))
+	{
+		fprintf(stderr, "'%s': %s\n", filename, z64yar_strerror(err));
+		free(yar->data);
+		free(yar);
+		return 0;
+	}
+	entries = malloc((yar->count + 1) * sizeof(*entries));
+	assert(entries);
+	z64yar_stat(yar->data, yar->dataSz, entries, yar->count, &yar->count);
 	
 	for (int i = 0; i < yar->count; ++i)
 	{
@@ -68,14 +104,13 @@ struct Yar *YarRead(const char *filename)
 			yar->head = this;
 		prev = this;
 		
-		this->data = body + U32read(stepHeader);
-		if (stepHeader == yar->data) // first file
-			this->data = body;
-		this->dataAddrUnyar = dataAddrUnyar;
-		dataAddrUnyar += U32read(((uint8_t*)this->data) + 4); // decompressed size
-		stepHeader += sizeof(uint32_t);
+		this->data = ((uint8_t*)yar->data) + entries[i].offset;
+		this->dataSz = entries[i].size;
+		this->codec = CodecFindName(entries[i].codec);
+		this->dataAddrUnyar = entries[i].unyarAddr;
 	}
 	
+	free(entries);
 	return yar;
 }
 
@@ -96,15 +131,19 @@ void YarFree(struct Yar *yar)
 	free(yar);
 }
 
-static int YarStat(const char *input)
+static int YarStat(const char *input, const struct Options *opt)
 {
 	struct Yar *yar = YarRead(input);
 	const char *period = strrchr(input, '.');
+	int rval = EXIT_SUCCESS;
 	
 	assert(period);
 	
 	if (!yar)
+	{
+		fprintf(stderr, "failed to read file '%s'\n", input);
 		return EXIT_FAILURE;
+	}
 	
 	fprintf(stdout, "%s # relative path\n", input);
 	fprintf(stdout, "%.*s/ # where the images live\n", (int)(period - input), input);
@@ -112,13 +151,42 @@ static int YarStat(const char *input)
 	for (struct YarEntry *this = yar->head; this; this = this->next)
 		fprintf(stdout, "??x??,unknown,%08x.png\n", this->dataAddrUnyar);
 	
+	// without a recipe, only the hashes are known
+	if (opt->manifest)
+	{
+		struct Manifest manifest = {0};
+		int i = 0;
+		
+		for (struct YarEntry *this = yar->head; this; this = this->next, ++i)
+		{
+			struct ManifestEntry entry = {0};
+			void *data;
+			size_t dataSz;
+			int err;
+			
+			if ((err = z64yar_extract(yar->data, yar->dataSz, i, &data, &dataSz)))
+			{
+				fprintf(stderr, "'%s' entry %d: %s\n", input, i, z64yar_strerror(err));
+				exit(EXIT_FAILURE);
+			}
+			entry.dataHash = Hash64(this->data, this->dataSz, 0);
+			entry.pixHash = Hash64(data, dataSz, 0);
+			sb_push(manifest.entries, entry);
+			z64yar_free(data);
+		}
+		
+		if (!ManifestSave(&manifest, input))
+			rval = EXIT_FAILURE;
+		sb_free(manifest.entries);
+	}
+	
 	YarFree(yar);
-	return EXIT_SUCCESS;
+	return rval;
 }
 
-static int YarUnyar(const char *infn, const char *outfn)
+static int YarUnyar(const char *infn, const char *outfn, int threads)
 {
-	if (unyar(infn, outfn, true))
+	if (unyar(infn, outfn, true, threads))
 	{
 		fprintf(stderr, "unyar '%s' into '%s' failed\n", infn, outfn);
 		
@@ -128,17 +196,27 @@ static int YarUnyar(const char *infn, const char *outfn)
 	return EXIT_SUCCESS;
 }
 
-static int YarDump(struct Recipe *recipe)
+// tells apart equal pixel data that would decode to different images
+static uint64_t TextureTag(const struct RecipeItem *item)
+{
+	return ((uint64_t)item->fmt << 56)
+		| ((uint64_t)item->bpp << 48)
+		| ((uint64_t)item->width << 24)
+		| (uint64_t)item->height
+	;
+}
+
+static int YarDump(struct Recipe *recipe, const struct Options *opt, struct Store *store)
 {
 	struct Yar *yar = YarRead(recipe->yarName);
 	struct YarEntry *yarEntry;
-	void *buffer = malloc(512 * 1024); // 512 KiB is plenty
-	void *bufferOut = malloc(1024 * 1024);
-	
-	assert(buffer);
+	struct Scratch scratch = {0};
 	
 	if (!yar)
+	{
+		fprintf(stderr, "failed to read file '%s'\n", recipe->yarName);
 		return EXIT_FAILURE;
+	}
 	
 	RecipePrint(recipe);
 	
@@ -147,22 +225,47 @@ static int YarDump(struct Recipe *recipe)
 #else
 	mkdir(recipe->imageDir, 0777);
 #endif
+	// items are streamed, so dumping begins before the recipe is fully read
 	yarEntry = yar->head;
-	for (struct RecipeItem *this = recipe->head
+	for (struct RecipeItem *this = RecipeNext(recipe)
 		; this && yarEntry
-		; this = this->next, yarEntry = yarEntry->next
+		; this = RecipeNext(recipe), yarEntry = yarEntry->next
 	)
 	{
 		unsigned unused;
+		size_t decSz = U32read(((uint8_t*)yarEntry->data) + 4);
+		size_t rgbaSz = (size_t)this->width * this->height * 4;
+		void *buffer = ScratchReserve(&scratch, decSz > rgbaSz ? decSz : rgbaSz);
+		char *imageFn = ImageFilename(this->imageFilename, opt->format);
+		struct StoreEntry *stored;
+		bool isNew;
 		
 		// decompress the compressed texture
-		spinout_yaz_dec(yarEntry->data, buffer, 0, &unused);
+		if (yarEntry->codec->decode(yarEntry->data, buffer, 0, &unused))
+		{
+			fprintf(stderr, "'%s' decompression error\n", this->imageFilename);
+			exit(EXIT_FAILURE);
+		}
 		
-		// convert to standard 32-bit rgba
-		// TODO fix n64texconv_to_rgba8888 so in-place 4-bit conversions don't corrupt first pixel
-		//      (using two buffers is an acceptable solution in the meantime)
+		// a texture seen before in this batch is linked to, not written
+		stored = StoreClaim(store, buffer, decSz, TextureTag(this), &isNew);
+		if (!isNew)
+		{
+			const char *firstFn = StoreWait(stored, 0);
+			
+			fprintf(stderr, "linking '%s' to '%s'\n", imageFn, firstFn);
+			if (!FileLink(firstFn, imageFn))
+			{
+				fprintf(stderr, "failed to write image '%s'\n", imageFn);
+				exit(EXIT_FAILURE);
+			}
+			free(imageFn);
+			continue;
+		}
+		
+		// convert to standard 32-bit rgba, in-place
 		n64texconv_to_rgba8888(
-			bufferOut
+			buffer
 			, buffer
 			, 0
 			, this->fmt
@@ -171,120 +274,894 @@ static int YarDump(struct Recipe *recipe)
 			, this->height
 		);
 		
-		// write as png
-		fprintf(stderr, "writing '%s'\n", this->imageFilename);
-		stbi_write_png(this->imageFilename, this->width, this->height, 4, bufferOut, this->width * 4);
+		// write as png (or the chosen --format)
+		fprintf(stderr, "writing '%s'\n", imageFn);
+		if (!ImageSave(imageFn, opt->format, this->width, this->height, buffer))
+		{
+			fprintf(stderr, "failed to write image '%s'\n", imageFn);
+			exit(EXIT_FAILURE);
+		}
+		StorePublish(stored, imageFn, strlen(imageFn) + 1);
+		free(imageFn);
 	}
 	
 	YarFree(yar);
 	
-	free(buffer);
-	free(bufferOut);
+	ScratchFree(&scratch);
 	return EXIT_SUCCESS;
 }
 
-static int YarBuild(struct Recipe *recipe)
+// appends an entry to an archive body, padding it so the next entry
+// starts 'align'-aligned within the file (whose header is 'headerSz'
+// bytes; it doesn't matter when align is 4), and records where it ends
+static void YarAppend(uint8_t **body, uint32_t **ends, const void *data, unsigned int sz, int align, int headerSz)
 {
-	void *buffer = malloc(512 * 1024); // 512 KiB is plenty
-	void *yazCtx = yazCtx_new();
-	FILE *out;
-	unsigned int rel;
+	memcpy(sb_add(*body, (int)sz), data, sz);
+	while ((headerSz + sb_count(*body)) % align)
+		sb_push(*body, 0);
 	
-	assert(buffer);
-	assert(recipe);
+	// used for header later
+	sb_push(*ends, sb_count(*body));
+}
+
+// writes an archive header followed by its body, padded to 16 bytes;
+// a header longer than its entries need ('headerSz', or 0 for none)
+// is filled out with the last end, the way yar_reencode pads it
+static void YarWrite(FILE *out, const char *outName, uint8_t *body, uint32_t *ends, int headerSz)
+{
+	int count = sb_count(ends);
 	
-	// TODO zzrtl doesn't like the filesize changing, so use rb+ instead of wb for now
-	//if (!(out = fopen(recipe->yarName, "wb")))
-	if (!(out = fopen(recipe->yarName, "rb+")))
+	if (headerSz < (count + 1) * (int)sizeof(uint32_t))
+		headerSz = (count + 1) * sizeof(uint32_t);
+	
+	// header
+	FilePutBE32(out, headerSz);
+	for (int i = 0; i < count; ++i)
+		FilePutBE32(out, ends[i]);
+	for (int i = count + 1; i < headerSz / 4; ++i)
+		FilePutBE32(out, count ? ends[count - 1] : 0);
+	
+	// write
+	if (fwrite(body, 1, sb_count(body), out) != (size_t)sb_count(body))
 	{
-		fprintf(stderr, "failed to open '%s' for writing\n", recipe->yarName);
+		fprintf(stderr, "error writing to file '%s'\n", outName);
 		exit(EXIT_FAILURE);
 	}
 	
-	// header
-	FilePutBE32(out, (recipe->count + 1) * sizeof(uint32_t));
-	for (int i = 0; i < recipe->count; ++i)
-		FilePutBE32(out, 0);
-	rel = ftell(out);
+	// alignment
+	while (ftell(out) & 15)
+		fputc(0, out);
+}
+
+// gray images bound for intensity formats needn't be expanded to rgba
+static int ImageChannelsFor(const struct RecipeItem *item)
+{
+	int channels = n64texconv_gray_channels(item->fmt, item->bpp);
 	
-	for (struct RecipeItem *this = recipe->head; this; this = this->next)
+	return channels ? channels : 4;
+}
+
+/* compression threads shared out between the workers of a pool; a
+ * worker holds one while compressing and borrows any that are idle,
+ * so a large texture still gets them all once the rest are done,
+ * without every worker splitting into -j threads of its own
+ */
+struct ThreadShare
+{
+	struct Mutex *lock;
+	int idle;
+};
+
+static int ThreadShareClaim(struct ThreadShare *share)
+{
+	int n;
+	
+	MutexLock(share->lock);
+	n = share->idle > 1 ? share->idle : 1;
+	share->idle -= n;
+	MutexUnlock(share->lock);
+	
+	return n;
+}
+
+static void ThreadShareRelease(struct ThreadShare *share, int n)
+{
+	MutexLock(share->lock);
+	share->idle += n;
+	MutexUnlock(share->lock);
+}
+
+/* building is pipelined: a reader thread decodes images in recipe
+ * order, a pool of workers converts and compresses them, and the
+ * main thread writes the results back out in recipe order
+ */
+struct BuildJob
+{
+	struct RecipeItem item; // owns its imageFilename
+	struct FileStamp stamp; // of the image, taken before reading it
+	struct Event *done; // set when data is ready
+	void *pix; // n64 pixels after conversion, kept for --fit
+	unsigned int pixSz;
+	uint64_t pixHash; // of pix after conversion
+	int channels; // of pix before conversion
+	uint8_t *data;
+	unsigned int dataSz;
+	int level;
+};
+
+struct BuildPipeline
+{
+	struct Recipe *recipe;
+	struct Queue *decoded; // reader -> workers
+	struct Queue *ordered; // reader -> writer, bounds jobs in flight
+	struct Store *store; // compressed data, shared by a batch of recipes
+	struct ThreadShare share;
+	int level;
+	bool fit;
+	enum ImageFormat format;
+};
+
+static void *YarBuildReader(void *udata)
+{
+	struct BuildPipeline *pipe = udata;
+	
+	for (struct RecipeItem *this; (this = RecipeNext(pipe->recipe)); )
 	{
-		const char *imgFn = this->imageFilename;
-		const char *errmsg = 0;
-		void *pix;
-		int w = 0;
-		int h = 0;
-		int unused;
-		unsigned int sz;
+		struct BuildJob *job = calloc(1, sizeof(*job));
+		const char *imgFn;
+		int w = this->width;
+		int h = this->height;
+		
+		assert(job);
+		job->item = *this;
+		job->item.imageFilename = ImageFilename(this->imageFilename, pipe->format);
+		job->done = EventNew();
+		imgFn = job->item.imageFilename;
+		
+		// the writer learns the order before the image is ready
+		QueuePush(pipe->ordered, job);
+		FileGetStamp(imgFn, &job->stamp);
 		
 		// load image
-		if (!(pix = stbi_load(imgFn, &w, &h, &unused, STBI_rgb_alpha)))
+		if (!(job->pix = ImageLoadChannels(imgFn, pipe->format, &w, &h
+			, ImageChannelsFor(&job->item), &job->channels))
+		)
 		{
 			fprintf(stderr, "failed to load image '%s'\n", imgFn);
 			exit(EXIT_FAILURE);
 		}
 		
 		// assert no size change
-		if (this->width != w || this->height != h)
+		if (job->item.width != w || job->item.height != h)
 		{
 			fprintf(stderr, "'%s' image unexpected dimensions\n", imgFn);
 			exit(EXIT_FAILURE);
 		}
 		
+		QueuePush(pipe->decoded, job);
+	}
+	
+	QueueClose(pipe->decoded);
+	QueueClose(pipe->ordered);
+	
+	return 0;
+}
+
+static void *YarBuildWorker(void *udata)
+{
+	struct BuildPipeline *pipe = udata;
+	void *yazCtx = yazCtx_new();
+	struct BuildJob *job;
+	
+	assert(yazCtx);
+	yazCtx_set_level(yazCtx, pipe->level);
+	
+	while ((job = QueuePop(pipe->decoded)))
+	{
+		struct RecipeItem *this = &job->item;
+		const char *errmsg = 0;
+		struct StoreEntry *stored;
+		unsigned int sz;
+		bool isNew;
+		
 		// convert to n64 pixel format
-		if ((errmsg = n64texconv_to_n64(pix, pix, 0, -1, this->fmt, this->bpp, w, h, &sz)))
+		if ((errmsg = n64texconv_to_n64_from_gray(job->pix, job->pix, job->channels, this->fmt, this->bpp, this->width, this->height, &sz)))
 		{
-			fprintf(stderr, "'%s' conversion error: %s\n", imgFn, errmsg);
+			fprintf(stderr, "'%s' conversion error: %s\n", this->imageFilename, errmsg);
 			exit(EXIT_FAILURE);
 		}
+		job->pixHash = Hash64(job->pix, sz, 0);
 		
-		// compress
-		if (yazenc(pix, sz, buffer, &sz, yazCtx))
+		// compress, once per unique payload in the batch; compression
+		// only sees bytes, so the texture format isn't part of the key
+		job->data = malloc(YAZ_ENCODE_BOUND(sz));
+		assert(job->data);
+		stored = StoreClaim(pipe->store, job->pix, sz, 0, &isNew);
+		if (!isNew)
+		{
+			size_t dataSz;
+			const void *data = StoreWait(stored, &dataSz);
+			
+			memcpy(job->data, data, dataSz);
+			job->dataSz = dataSz;
+		}
+		else
+		{
+			int threads = ThreadShareClaim(&pipe->share);
+			int err;
+			
+			// large textures are also split across threads when compressed
+			yazCtx_set_threads(yazCtx, threads);
+			err = yazenc(job->pix, sz, job->data, &job->dataSz, yazCtx);
+			ThreadShareRelease(&pipe->share, threads);
+			if (err)
+			{
+				fprintf(stderr, "compression error\n");
+				exit(EXIT_FAILURE);
+			}
+			StorePublish(stored, job->data, job->dataSz);
+		}
+		job->pixSz = sz;
+		job->level = pipe->level;
+		
+		if (!pipe->fit)
+		{
+			ImageFree(job->pix);
+			job->pix = 0;
+		}
+		EventSet(job->done);
+	}
+	
+	yazCtx_free(yazCtx);
+	
+	return 0;
+}
+
+// size of the archive the jobs would be written as
+static long YarBuildSize(struct BuildJob **jobs)
+{
+	long sz = (sb_count(jobs) + 1) * sizeof(uint32_t);
+	
+	for (int i = 0; i < sb_count(jobs); ++i)
+		sz += (jobs[i]->dataSz + 3) & ~3;
+	
+	return (sz + 15) & ~15;
+}
+
+static int YarBuildFitCompare(const void *a, const void *b)
+{
+	const struct BuildJob *jobA = *(struct BuildJob * const *)a;
+	const struct BuildJob *jobB = *(struct BuildJob * const *)b;
+	
+	// largest first
+	return (jobA->dataSz < jobB->dataSz) - (jobA->dataSz > jobB->dataSz);
+}
+
+// recompresses entries at higher levels, largest first, until the
+// archive fits within 'budget' bytes; exits with a report if it can't
+static void YarBuildFit(struct BuildJob **jobs, long budget, int threads)
+{
+	struct BuildJob **bySize = 0; // stretchy buffer
+	void *yazCtx = yazCtx_new();
+	long total = YarBuildSize(jobs);
+	
+	assert(yazCtx);
+	yazCtx_set_threads(yazCtx, threads);
+	yazCtx_set_level(yazCtx, YAZ_LEVEL_MAX);
+	
+	memcpy(sb_add(bySize, sb_count(jobs)), jobs, sb_count(jobs) * sizeof(*jobs));
+	qsort(bySize, sb_count(bySize), sizeof(*bySize), YarBuildFitCompare);
+	
+	for (int i = 0; i < sb_count(bySize) && total > budget; ++i)
+	{
+		struct BuildJob *job = bySize[i];
+		
+		if (job->level >= YAZ_LEVEL_MAX)
+			continue;
+		
+		if (yazenc(job->pix, job->pixSz, job->data, &job->dataSz, yazCtx))
 		{
 			fprintf(stderr, "compression error\n");
 			exit(EXIT_FAILURE);
 		}
+		job->level = YAZ_LEVEL_MAX;
+		total = YarBuildSize(jobs);
+	}
+	
+	if (total > budget)
+	{
+		fprintf(stderr, "archive is %ld bytes, which exceeds its %ld byte slot by %ld:\n"
+			, total, budget, total - budget
+		);
+		for (int i = 0; i < sb_count(jobs); ++i)
+			fprintf(stderr, " entry %3d: %6u bytes '%s'\n"
+				, i, jobs[i]->dataSz, jobs[i]->item.imageFilename
+			);
+		exit(EXIT_FAILURE);
+	}
+	
+	yazCtx_free(yazCtx);
+	sb_free(bySize);
+}
+
+// appends a finished job's entry to the archive body, then frees the job
+static void YarBuildAppend(uint8_t **body, uint32_t **ends, struct BuildJob *job, struct Manifest *manifest)
+{
+	int i = sb_count(*ends);
+	
+	YarAppend(body, ends, job->data, job->dataSz, 4, 0);
+	
+	if (manifest)
+	{
+		uint32_t start = i ? (*ends)[i - 1] : 0;
+		struct ManifestEntry entry = {
+			.dataHash = Hash64(*body + start, (*ends)[i] - start, 0)
+			, .pixHash = job->pixHash
+			, .fmt = job->item.fmt
+			, .bpp = job->item.bpp
+			, .width = job->item.width
+			, .height = job->item.height
+			, .imageStamp = job->stamp
+			, .imageFilename = job->item.imageFilename
+		};
+		
+		// which now owns the filename
+		sb_push(manifest->entries, entry);
+		job->item.imageFilename = 0;
+	}
+	
+	// cleanup
+	free(job->item.imageFilename);
+	free(job->data);
+	ImageFree(job->pix);
+	free(job);
+}
+
+// whether building would only write the archive the manifest describes
+static bool YarBuildIsCurrent(struct Recipe *recipe, const struct Options *opt, const struct Manifest *manifest)
+{
+	struct FileStamp stamp;
+	
+	if (!manifest->recipeFilename
+		|| strcmp(manifest->recipeFilename, recipe->filename)
+		|| !FileGetStamp(recipe->filename, &stamp)
+		|| !FileStampEqual(&stamp, &manifest->recipeStamp)
+		|| manifest->level != opt->level
+		|| manifest->fit != opt->fit
+		|| manifest->format != (int)opt->format
+	)
+		return false;
+	
+	for (int i = 0; i < sb_count(manifest->entries); ++i)
+	{
+		const struct ManifestEntry *entry = &manifest->entries[i];
+		
+		if (!entry->imageFilename
+			|| !FileGetStamp(entry->imageFilename, &stamp)
+			|| !FileStampEqual(&stamp, &entry->imageStamp)
+		)
+			return false;
+	}
+	
+	return true;
+}
+
+static int YarBuild(struct Recipe *recipe, const struct Options *opt, struct Store *store)
+{
+	struct BuildPipeline pipe = {
+		.recipe = recipe
+		, .store = store
+		, .share = { MutexNew(), opt->threads }
+		, .level = opt->level
+		, .fit = opt->fit
+		, .format = opt->format
+	};
+	struct BuildJob **jobs = 0; // stretchy buffer
+	struct Thread **workers = 0; // stretchy buffer
+	struct Thread *reader;
+	struct BuildJob *job;
+	uint8_t *body = 0; // stretchy buffer
+	uint32_t *ends = 0; // stretchy buffer
+	struct Manifest *manifest = ManifestLoad(recipe->yarName);
+	char *manifestFn = ManifestFilename(recipe->yarName);
+	struct FileStamp stamp;
+	long budget;
+	FILE *out;
+	
+	assert(recipe);
+	
+	// nothing the archive was built from has changed since
+	if (manifest && YarBuildIsCurrent(recipe, opt, manifest))
+	{
+		fprintf(stderr, "'%s' is up to date\n", recipe->yarName);
+		ManifestFree(manifest);
+		free(manifestFn);
+		return EXIT_SUCCESS;
+	}
+	ManifestFree(manifest);
+	manifest = 0;
+	
+	// once written, a manifest is kept up to date
+	if (opt->manifest || FileGetStamp(manifestFn, &stamp))
+	{
+		manifest = calloc(1, sizeof(*manifest));
+		assert(manifest);
+		manifest->recipeFilename = Strdup(recipe->filename);
+		FileGetStamp(recipe->filename, &manifest->recipeStamp);
+		manifest->level = opt->level;
+		manifest->fit = opt->fit;
+		manifest->format = opt->format;
+	}
+	free(manifestFn);
+	
+	// TODO zzrtl doesn't like the filesize changing, so use rb+ instead of wb for now
+	//if (!(out = fopen(recipe->yarName, "wb")))
+	if (!(out = fopen(recipe->yarName, "rb+")))
+	{
+		fprintf(stderr, "failed to open '%s' for writing\n", recipe->yarName);
+		exit(EXIT_FAILURE);
+	}
+	
+	// the original archive's size is the budget for --fit
+	fseek(out, 0, SEEK_END);
+	budget = ftell(out);
+	rewind(out);
+	
+	// start the pipeline
+	pipe.decoded = QueueNew(opt->queueDepth);
+	pipe.ordered = QueueNew(opt->queueDepth * 2 + opt->threads);
+	if (!(reader = ThreadNew(YarBuildReader, &pipe)))
+	{
+		fprintf(stderr, "failed to create reader thread\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < opt->threads; ++i)
+	{
+		struct Thread *worker = ThreadNew(YarBuildWorker, &pipe);
 		
-		// write
-		if (fwrite(buffer, 1, sz, out) != sz)
+		if (!worker)
 		{
-			fprintf(stderr, "error writing to file '%s'\n", recipe->yarName);
+			fprintf(stderr, "failed to create worker thread\n");
 			exit(EXIT_FAILURE);
 		}
-		
-		// alignment
-		while (ftell(out) & 3)
+		sb_push(workers, worker);
+	}
+	
+	// items are streamed, so the number of entries (and thus the header
+	// size) isn't known until the end; each entry joins the body as it
+	// completes, and only --fit holds on to every job to recompress them
+	while ((job = QueuePop(pipe.ordered)))
+	{
+		EventWait(job->done);
+		EventFree(job->done);
+		if (opt->fit)
+			sb_push(jobs, job);
+		else
+			YarBuildAppend(&body, &ends, job, manifest);
+	}
+	ThreadJoin(reader);
+	for (int i = 0; i < sb_count(workers); ++i)
+		ThreadJoin(workers[i]);
+	QueueFree(pipe.decoded);
+	QueueFree(pipe.ordered);
+	MutexFree(pipe.share.lock);
+	sb_free(workers);
+	
+	if (opt->fit)
+	{
+		YarBuildFit(jobs, budget, opt->threads);
+		for (int i = 0; i < sb_count(jobs); ++i)
+			YarBuildAppend(&body, &ends, jobs[i], manifest);
+		sb_free(jobs);
+	}
+	
+	// the archive is only overwritten once every image has been read
+	// and compressed, so a bad image leaves it untouched
+	YarWrite(out, recipe->yarName, body, ends, 0);
+	
+	// zero-fill the rest of the slot so no stale bytes remain
+	if (opt->fit)
+		while (ftell(out) < budget)
 			fputc(0, out);
+	
+	fclose(out);
+	sb_free(body);
+	sb_free(ends);
+	
+	if (manifest)
+	{
+		bool ok = ManifestSave(manifest, recipe->yarName);
 		
-		// used for header later
-		this->endOffset = ftell(out) - rel;
+		ManifestFree(manifest);
+		if (!ok)
+			return EXIT_FAILURE;
+	}
+	
+	return EXIT_SUCCESS;
+}
+
+/* verifying compares each entry with what building its image would
+ * produce, without writing anything; workers take one entry each
+ */
+struct VerifyJob
+{
+	struct RecipeItem *item;
+	struct YarEntry *entry;
+	const struct ManifestEntry *known; // from the manifest, if any
+	bool isUnchanged; // built from this very image, according to it
+	char problem[128]; // empty if the entry matches
+};
+
+struct VerifyPool
+{
+	struct Queue *jobs;
+	enum ImageFormat format;
+};
+
+// describes the first pixel at which two textures differ
+static void YarVerifyDescribe(struct VerifyJob *job, uint8_t *archived, uint8_t *built, unsigned int sz)
+{
+	const struct RecipeItem *this = job->item;
+	size_t rgbaSz = (size_t)this->width * this->height * 4;
+	uint8_t *a = malloc(rgbaSz);
+	uint8_t *b = malloc(rgbaSz);
+	unsigned int byte = 0;
+	size_t pixel;
+	
+	assert(a);
+	assert(b);
+	
+	while (byte < sz && archived[byte] == built[byte])
+		++byte;
+	pixel = (size_t)byte * 8 / (4 << this->bpp);
+	
+	n64texconv_to_rgba8888(a, archived, 0, this->fmt, this->bpp, this->width, this->height);
+	n64texconv_to_rgba8888(b, built, 0, this->fmt, this->bpp, this->width, this->height);
+	snprintf(job->problem, sizeof(job->problem)
+		, "first differs at pixel (%d, %d): %08X in archive, %08X in image"
+		, (int)(pixel % this->width)
+		, (int)(pixel / this->width)
+		, U32read(a + pixel * 4)
+		, U32read(b + pixel * 4)
+	);
+	
+	free(a);
+	free(b);
+}
+
+static void *YarVerifyWorker(void *udata)
+{
+	struct VerifyPool *pool = udata;
+	struct Scratch scratch = {0};
+	struct VerifyJob *job;
+	
+	while ((job = QueuePop(pool->jobs)))
+	{
+		struct RecipeItem *this = job->item;
+		const struct ManifestEntry *known = job->known;
+		char *imageFn = ImageFilename(this->imageFilename, pool->format);
+		unsigned int decSz = U32read(((uint8_t*)job->entry->data) + 4);
+		uint8_t *archived = ScratchReserve(&scratch, decSz + 1);
+		struct FileStamp stamp;
+		const char *errmsg;
+		unsigned unused;
+		unsigned int sz;
+		void *pix;
+		int w = this->width;
+		int h = this->height;
+		int channels;
 		
-		// cleanup
-		stbi_image_free(pix);
+		// the manifest is only loaded while the archive is unchanged, so
+		// an entry it says was built from this very image needs no check
+		if (known
+			&& known->imageFilename
+			&& !strcmp(known->imageFilename, imageFn)
+			&& known->fmt == (int)this->fmt
+			&& known->bpp == (int)this->bpp
+			&& known->width == this->width
+			&& known->height == this->height
+			&& FileGetStamp(imageFn, &stamp)
+			&& FileStampEqual(&stamp, &known->imageStamp)
+		)
+			job->isUnchanged = true;
+		else if (!(pix = ImageLoadChannels(imageFn, pool->format, &w, &h, ImageChannelsFor(this), &channels)))
+			snprintf(job->problem, sizeof(job->problem), "failed to load image");
+		else
+		{
+			// convert the image as building it would
+			if (this->width != w || this->height != h)
+				snprintf(job->problem, sizeof(job->problem), "image unexpected dimensions");
+			else if ((errmsg = n64texconv_to_n64_from_gray(pix, pix, channels, this->fmt, this->bpp, w, h, &sz)))
+				snprintf(job->problem, sizeof(job->problem), "conversion error: %s", errmsg);
+			else if (sz != decSz)
+				snprintf(job->problem, sizeof(job->problem)
+					, "archive holds %u bytes, image converts to %u", decSz, sz
+				);
+			// matching the manifest's hash spares decompressing the entry
+			else if (known && Hash64(pix, sz, 0) == known->pixHash)
+				;
+			else if (job->entry->codec->decode(job->entry->data, archived, 0, &unused))
+				snprintf(job->problem, sizeof(job->problem), "decompression error");
+			else if (Hash64(archived, sz, 0) != Hash64(pix, sz, 0))
+				YarVerifyDescribe(job, archived, pix, sz);
+			
+			ImageFree(pix);
+		}
+		
+		free(imageFn);
 	}
 	
-	// alignment
-	while (ftell(out) & 15)
-		fputc(0, out);
+	ScratchFree(&scratch);
 	
-	// header
-	fseek(out, 4, SEEK_SET);
-	for (struct RecipeItem *this = recipe->head; this; this = this->next)
-		FilePutBE32(out, this->endOffset);
+	return 0;
+}
+
+static int YarVerify(struct Recipe *recipe, const struct Options *opt)
+{
+	struct Yar *yar = YarRead(recipe->yarName);
+	struct VerifyPool pool = { .format = opt->format };
+	struct Manifest *manifest = ManifestLoad(recipe->yarName);
+	struct VerifyJob *jobs = 0; // stretchy buffer
+	struct Thread **workers;
+	struct YarEntry *yarEntry;
+	int mismatched = 0;
+	int unchanged = 0;
+	int i;
+	
+	if (!yar)
+	{
+		fprintf(stderr, "failed to read file '%s'\n", recipe->yarName);
+		ManifestFree(manifest);
+		return EXIT_FAILURE;
+	}
+	
+	RecipeLoadItems(recipe);
+	yarEntry = yar->head;
+	for (struct RecipeItem *this = recipe->head; this && yarEntry; this = this->next, yarEntry = yarEntry->next)
+	{
+		struct VerifyJob *job = sb_add(jobs, 1);
+		
+		memset(job, 0, sizeof(*job));
+		job->item = this;
+		job->entry = yarEntry;
+		if (manifest && sb_count(jobs) <= sb_count(manifest->entries))
+			job->known = &manifest->entries[sb_count(jobs) - 1];
+	}
+	
+	// jobs is complete, so pointers into it stay put
+	workers = calloc(opt->threads, sizeof(*workers));
+	assert(workers);
+	pool.jobs = QueueNew(sb_count(jobs) + 1);
+	for (i = 0; i < sb_count(jobs); ++i)
+		QueuePush(pool.jobs, &jobs[i]);
+	QueueClose(pool.jobs);
+	for (i = 0; i < opt->threads; ++i)
+		if (!(workers[i] = ThreadNew(YarVerifyWorker, &pool)))
+			YarVerifyWorker(&pool);
+	for (i = 0; i < opt->threads; ++i)
+		ThreadJoin(workers[i]);
+	QueueFree(pool.jobs);
+	
+	// report in recipe order
+	for (i = 0; i < sb_count(jobs); ++i)
+	{
+		char *imageFn;
+		
+		unchanged += jobs[i].isUnchanged;
+		if (!*jobs[i].problem)
+			continue;
+		
+		imageFn = ImageFilename(jobs[i].item->imageFilename, opt->format);
+		fprintf(stderr, "entry %3d '%s': %s\n", i, imageFn, jobs[i].problem);
+		free(imageFn);
+		mismatched += 1;
+	}
+	if (recipe->count != yar->count)
+	{
+		fprintf(stderr, "recipe lists %d images, archive holds %d entries\n", recipe->count, yar->count);
+		mismatched += 1;
+	}
+	fprintf(stderr, "'%s': %d entries verified, %d mismatched", recipe->yarName, sb_count(jobs), mismatched);
+	if (manifest)
+		fprintf(stderr, " (%d unchanged since the manifest was written)", unchanged);
+	fprintf(stderr, "\n");
+	
+	ManifestFree(manifest);
+	YarFree(yar);
+	sb_free(jobs);
+	free(workers);
+	return mismatched ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* recompresses every entry of an existing archive */
+struct RepackJob
+{
+	struct YarEntry *entry;
+	uint8_t *data;
+	unsigned int dataSz;
+};
+
+struct RepackPool
+{
+	struct Queue *jobs;
+	const struct Codec *codec;
+	struct ThreadShare share;
+	int level;
+};
+
+static void *YarRepackWorker(void *udata)
+{
+	struct RepackPool *pool = udata;
+	void *yazCtx = yazCtx_new();
+	struct RepackJob *job;
+	
+	assert(yazCtx);
+	yazCtx_set_level(yazCtx, pool->level);
+	
+	while ((job = QueuePop(pool->jobs)))
+	{
+		unsigned int sz = U32read(((uint8_t*)job->entry->data) + 4); // decompressed size
+		void *buffer = malloc(sz);
+		unsigned int unused;
+		int threads;
+		int err;
+		
+		assert(buffer);
+		job->data = malloc(YAZ_ENCODE_BOUND(sz));
+		assert(job->data);
+		
+		if (job->entry->codec->decode(job->entry->data, buffer, sz, &unused))
+		{
+			fprintf(stderr, "decompression error\n");
+			exit(EXIT_FAILURE);
+		}
+		threads = ThreadShareClaim(&pool->share);
+		yazCtx_set_threads(yazCtx, threads);
+		err = (pool->codec ? pool->codec : job->entry->codec)->encode(buffer, sz, job->data, &job->dataSz, yazCtx);
+		ThreadShareRelease(&pool->share, threads);
+		if (err)
+		{
+			fprintf(stderr, "compression error\n");
+			exit(EXIT_FAILURE);
+		}
+		
+		free(buffer);
+	}
 	
-	fclose(out);
 	yazCtx_free(yazCtx);
-	free(buffer);
+	
+	return 0;
+}
+
+static int YarRepack(const char *infn, const char *outfn, const struct Options *opt)
+{
+	struct Yar *yar = YarRead(infn);
+	struct RepackPool pool = {
+		.codec = opt->codec
+		, .share = { MutexNew(), opt->threads }
+		, .level = opt->level
+	};
+	struct RepackJob *jobs;
+	struct Thread **workers;
+	uint8_t *body = 0; // stretchy buffer
+	uint32_t *ends = 0; // stretchy buffer
+	unsigned int oldTotal = 0;
+	unsigned int newTotal = 0;
+	int headerSz;
+	int align = 16;
+	int i;
+	FILE *out;
+	
+	if (!yar)
+	{
+		fprintf(stderr, "failed to read file '%s'\n", infn);
+		return EXIT_FAILURE;
+	}
+	
+	// keep the header's size too, so a padded one stays aligned
+	headerSz = U32read(yar->data);
+	jobs = calloc(yar->count, sizeof(*jobs));
+	workers = calloc(opt->threads, sizeof(*workers));
+	assert(jobs);
+	assert(workers);
+	
+	// keep the alignment the original archive used
+	i = 0;
+	for (struct YarEntry *this = yar->head; this; this = this->next)
+	{
+		unsigned int ofs = ((uint8_t*)this->data) - ((uint8_t*)yar->data);
+		
+		while (ofs % align)
+			align /= 2;
+		jobs[i++].entry = this;
+	}
+	if (align < 4)
+		align = 4;
+	
+	// recompress
+	pool.jobs = QueueNew(yar->count + 1);
+	for (i = 0; i < yar->count; ++i)
+		QueuePush(pool.jobs, &jobs[i]);
+	QueueClose(pool.jobs);
+	for (i = 0; i < opt->threads; ++i)
+		if (!(workers[i] = ThreadNew(YarRepackWorker, &pool)))
+			YarRepackWorker(&pool);
+	for (i = 0; i < opt->threads; ++i)
+		ThreadJoin(workers[i]);
+	QueueFree(pool.jobs);
+	MutexFree(pool.share.lock);
+	
+	// assemble the archive and report the savings
+	for (i = 0; i < yar->count; ++i)
+	{
+		struct RepackJob *job = &jobs[i];
+		unsigned int oldSz = job->entry->dataSz;
+		unsigned int newSz;
+		
+		YarAppend(&body, &ends, job->data, job->dataSz, align, headerSz);
+		newSz = ends[i] - (i ? ends[i - 1] : 0);
+		oldTotal += oldSz;
+		newTotal += newSz;
+		fprintf(stderr, "entry %3d: %6u -> %6u bytes (%d saved)\n"
+			, i, oldSz, newSz, (int)(oldSz - newSz)
+		);
+		free(job->data);
+	}
+	fprintf(stderr, "total:     %6u -> %6u bytes (%d saved)\n"
+		, oldTotal, newTotal, (int)(oldTotal - newTotal)
+	);
+	
+	if (!(out = fopen(outfn, "wb")))
+	{
+		fprintf(stderr, "failed to open '%s' for writing\n", outfn);
+		exit(EXIT_FAILURE);
+	}
+	YarWrite(out, outfn, body, ends, headerSz);
+	fclose(out);
+	
+	YarFree(yar);
+	free(jobs);
+	free(workers);
+	sb_free(body);
+	sb_free(ends);
 	return EXIT_SUCCESS;
 }
 
-static int RetextureDump(struct Recipe *recipe)
+// renames a loaded recipe's images to suit the chosen --format
+static void RetextureApplyFormat(struct Recipe *recipe, enum ImageFormat format)
+{
+	for (struct RecipeItem *this = recipe->head; this; this = this->next)
+	{
+		char *imageFn;
+		
+		if (!strcmp(this->imageFilename, "auto"))
+			continue;
+		
+		imageFn = ImageFilename(this->imageFilename, format);
+		this->imageFilename = ArenaStrdup(recipe->arena, imageFn);
+		free(imageFn);
+	}
+}
+
+static int RetextureDump(struct Recipe *recipe, const struct Options *opt)
 {
 	size_t dataSz;
 	uint8_t *data = FileLoad(recipe->yarName, &dataSz);
-	void *buffer = malloc(512 * 1024); // 512 KiB is plenty
+	uint8_t *buffer;
+	size_t bufferSz = 0;
 	int rval = EXIT_SUCCESS;
 	
+	// big enough for the largest image (palettes are n x 1)
+	for (struct RecipeItem *this = recipe->head; this; this = this->next)
+	{
+		size_t sz = this->palMaxColors
+			? (size_t)this->palMaxColors * 4
+			: (size_t)this->width * this->height * 4;
+		
+		if (sz > bufferSz)
+			bufferSz = sz;
+	}
+	buffer = malloc(bufferSz + 1);
 	assert(buffer);
 	
 	if (!data)
@@ -341,9 +1218,14 @@ static int RetextureDump(struct Recipe *recipe)
 			, this->height
 		);
 		
-		// write as png
+		// write as png (or the chosen --format)
 		fprintf(stderr, "writing '%s'\n", imageFn);
-		stbi_write_png(imageFn, this->width, this->height, 4, buffer, this->width * 4);
+		if (!ImageSave(imageFn, opt->format, this->width, this->height, buffer))
+		{
+			fprintf(stderr, "failed to write image '%s'\n", imageFn);
+			rval = EXIT_FAILURE;
+			break;
+		}
 	}
 	
 	free(data);
@@ -351,14 +1233,14 @@ static int RetextureDump(struct Recipe *recipe)
 	return rval;
 }
 
-static int RetextureBuildInject(struct RecipeItem *this, uint8_t **data, size_t *dataSz)
+static int RetextureBuildInject(struct RecipeItem *this, uint8_t **data, size_t *dataSz, enum ImageFormat format)
 {
 	const char *imgFn = this->imageFilename;
 	const char *errmsg = 0;
 	void *pix;
-	int w = 0;
-	int h = 0;
-	int unused;
+	int w = this->width;
+	int h = this->height;
+	int channels;
 	unsigned int sz;
 	
 	// skip those already written
@@ -377,7 +1259,7 @@ static int RetextureBuildInject(struct RecipeItem *this, uint8_t **data, size_t
 	}
 	
 	// load image
-	if (!(pix = stbi_load(imgFn, &w, &h, &unused, STBI_rgb_alpha)))
+	if (!(pix = ImageLoadChannels(imgFn, format, &w, &h, ImageChannelsFor(this), &channels)))
 	{
 		fprintf(stderr, "failed to load image '%s'\n", imgFn);
 		exit(EXIT_FAILURE);
@@ -391,7 +1273,7 @@ static int RetextureBuildInject(struct RecipeItem *this, uint8_t **data, size_t
 	}
 	
 	// convert to n64 pixel format
-	if ((errmsg = n64texconv_to_n64(pix, pix, 0, -1, this->fmt, this->bpp, w, h, &sz)))
+	if ((errmsg = n64texconv_to_n64_from_gray(pix, pix, channels, this->fmt, this->bpp, w, h, &sz)))
 	{
 		fprintf(stderr, "'%s' conversion error: %s\n", imgFn, errmsg);
 		exit(EXIT_FAILURE);
@@ -415,23 +1297,53 @@ static int RetextureBuildInject(struct RecipeItem *this, uint8_t **data, size_t
 	memcpy((*data) + this->writeAt, pix, sz);
 	
 	// cleanup
-	stbi_image_free(pix);
+	ImageFree(pix);
 	return EXIT_SUCCESS;
 }
 
-static int RetextureBuild(struct Recipe *recipe)
+static int RetextureBuild(struct Recipe *recipe, const struct Options *opt)
 {
 	size_t dataSz;
 	uint8_t *data = FileLoad(recipe->yarName, &dataSz);
-	uint8_t *buffer = malloc(512 * 1024); // 512 KiB is plenty
-	uint8_t *buffer2 = malloc(512 * 1024);
-	uint8_t *writeHead = buffer;
+	uint8_t *buffer;
+	uint8_t *buffer2;
+	uint8_t *writeHead;
 	uint8_t *palette;
 	exq_data *quant;
 	int rval = EXIT_SUCCESS;
 	unsigned int sz;
+	size_t bufferSz = 0;
+	size_t buffer2Sz = 0;
+	size_t used = 0;
 	
+	// buffer accumulates the rgba of every color-indexed image, palette
+	// after palette, with room for the current palette past the end;
+	// buffer2 holds one palette index per pixel of any one image
+	for (struct RecipeItem *pal = recipe->head; pal; pal = pal->next)
+	{
+		if (pal->palMaxColors == 0)
+			continue;
+		
+		for (struct RecipeItem *this = recipe->head; this; this = this->next)
+		{
+			size_t pixels = (size_t)this->width * this->height;
+			
+			if (this->fmt != N64TEXCONV_CI || pal->palId != this->palId)
+				continue;
+			
+			used += pixels * STBI_rgb_alpha;
+			if (pixels > buffer2Sz)
+				buffer2Sz = pixels;
+		}
+		
+		if (used + pal->palMaxColors * STBI_rgb_alpha > bufferSz)
+			bufferSz = used + pal->palMaxColors * STBI_rgb_alpha;
+	}
+	buffer = malloc(bufferSz + 1);
+	buffer2 = malloc(buffer2Sz + 1);
+	writeHead = buffer;
 	assert(buffer);
+	assert(buffer2);
 	
 	if (!data)
 	{
@@ -448,8 +1360,8 @@ static int RetextureBuild(struct Recipe *recipe)
 	// first pass: construct the palettes
 	for (struct RecipeItem *pal = recipe->head; pal; pal = pal->next)
 	{
-		// is not palette
-		if (pal->palMaxColors == 0)
+		// is not palette, or its group is already written
+		if (pal->palMaxColors == 0 || pal->isAlreadyWritten)
 			continue;
 		
 		// load all the images into buffer
@@ -458,16 +1370,15 @@ static int RetextureBuild(struct Recipe *recipe)
 			const char *imgFn = this->imageFilename;
 			const char *errmsg;
 			void *pix;
-			int w;
-			int h;
-			int unused;
+			int w = this->width;
+			int h = this->height;
 			
 			// skip images that aren't using this palette
 			if (this->fmt != N64TEXCONV_CI || pal->palId != this->palId)
 				continue;
 			
 			// load image
-			if (!(pix = stbi_load(imgFn, &w, &h, &unused, STBI_rgb_alpha)))
+			if (!(pix = ImageLoad(imgFn, opt->format, &w, &h)))
 			{
 				fprintf(stderr, "failed to load image '%s'\n", imgFn);
 				exit(EXIT_FAILURE);
@@ -492,7 +1403,7 @@ static int RetextureBuild(struct Recipe *recipe)
 			memcpy(writeHead, pix, w * h * STBI_rgb_alpha);
 			writeHead += w * h * STBI_rgb_alpha;
 			
-			stbi_image_free(pix);
+			ImageFree(pix);
 		}
 		
 		// quantize them and construct palette
@@ -505,12 +1416,11 @@ static int RetextureBuild(struct Recipe *recipe)
 			{
 				void *pix;
 				const char *imgFn = pal->imageFilename;
-				int w;
-				int h;
-				int unused;
+				int w = pal->palMaxColors;
+				int h = 1;
 				
 				// load image
-				if (!(pix = stbi_load(imgFn, &w, &h, &unused, STBI_rgb_alpha)))
+				if (!(pix = ImageLoad(imgFn, opt->format, &w, &h)))
 				{
 					fprintf(stderr, "failed to load palette '%s'\n", imgFn);
 					exit(EXIT_FAILURE);
@@ -531,7 +1441,7 @@ static int RetextureBuild(struct Recipe *recipe)
 				
 				// upload original palette
 				exq_feed(quant, pix, pal->palMaxColors);
-				stbi_image_free(pix);
+				ImageFree(pix);
 			}
 			// otherwise, generate one from the textures
 			else
@@ -585,7 +1495,7 @@ static int RetextureBuild(struct Recipe *recipe)
 	
 	for (struct RecipeItem *this = recipe->head; this; this = this->next)
 	{
-		RetextureBuildInject(this, &data, &dataSz);
+		RetextureBuildInject(this, &data, &dataSz, opt->format);
 	}
 	
 	FILE *out = fopen(recipe->yarName, "wb");
@@ -602,16 +1512,75 @@ static int RetextureBuild(struct Recipe *recipe)
 	return rval;
 }
 
+// rebuilds the items of a retexture recipe whose images changed, and
+// every item sharing a palette with them; everything if changed is 0
+static int RetextureRebuild(const char *recipeFn, char **changed, int changedCount, void *udata)
+{
+	const struct Options *opt = udata;
+	struct Recipe *recipe = RecipeRead(recipeFn);
+	int *palIds = 0; // stretchy buffer
+	int rval;
+	
+	RetextureApplyFormat(recipe, opt->format);
+	
+	if (changed)
+	{
+		for (struct RecipeItem *this = recipe->head; this; this = this->next)
+		{
+			this->isAlreadyWritten = true;
+			for (int i = 0; i < changedCount; ++i)
+			{
+				if (strcmp(this->imageFilename, changed[i]))
+					continue;
+				
+				this->isAlreadyWritten = false;
+				if (this->fmt == N64TEXCONV_CI || this->palMaxColors)
+					sb_push(palIds, this->palId);
+			}
+		}
+		
+		// a palette is quantized from all of its images at once
+		for (struct RecipeItem *this = recipe->head; this; this = this->next)
+			for (int i = 0; i < sb_count(palIds); ++i)
+				if ((this->fmt == N64TEXCONV_CI || this->palMaxColors) && this->palId == palIds[i])
+					this->isAlreadyWritten = false;
+	}
+	
+	rval = RetextureBuild(recipe, opt);
+	RecipeFree(recipe);
+	sb_free(palIds);
+	
+	return rval;
+}
+
 static void ShowArgs(void)
 {
 	#define OUT(X) fprintf(stderr, X "\n");
 	
 	OUT("usage examples:")
-	OUT(" z64yartool stat input.yar > recipe.txt")
-	OUT(" z64yartool unyar input.yar output.bin")
-	OUT(" z64yartool dump recipe.txt")
-	OUT(" z64yartool build recipe.txt")
+	OUT(" z64yartool stat input.yar [--manifest] > recipe.txt")
+	OUT(" z64yartool unyar input.yar output.bin [-j threads]")
+	OUT(" z64yartool dump recipe.txt [more.txt...] [--format png|raw|pam|bmp|qoi] [--png-level n]")
+	OUT(" z64yartool build recipe.txt [more.txt...] [-j threads] [--queue-depth n] [--level n|max] [--fit] [--manifest]")
+	OUT(" z64yartool verify recipe.txt [more.txt...] [-j threads] [--format name]")
 	OUT(" z64yartool print recipe.txt")
+	OUT(" z64yartool compile recipe.txt recipe.bin")
+	OUT(" z64yartool repack input.yar output.yar [--level n|max] [--codec name] [-j threads]")
+	OUT(" z64yartool serve --socket path [-j threads]")
+	OUT(" z64yartool watch recipe.txt [-j threads] [--level n|max] [--format name]")
+	OUT(" z64yartool scan rom.z64 [output-directory] [-j threads]")
+	
+	OUT("options:")
+	OUT(" -j n             number of worker threads (default: one per cpu)")
+	OUT(" --queue-depth n  images decoded ahead of the workers (default: 4)")
+	OUT(" --level n|max    compression level, 1 (default) or 2 (max)")
+	OUT(" --fit            build: keep the archive within its original size")
+	OUT(" --manifest       build/stat: write a hash manifest beside the archive")
+	OUT(" --codec name     repack: convert entries to Yaz0, Yay0, or MIO0")
+	OUT(" --format name    dump/build: image format, png (default), raw, pam, bmp, or qoi")
+	fprintf(stderr, " --png-level n    png compression, 0 (fastest, uncompressed) to 9 (default: %d)\n", IMAGE_PNG_LEVEL_DEFAULT);
+	OUT(" --png-filter n   png row filter 0-4 (default: best per row)")
+	OUT(" --socket path    serve: unix domain socket to answer requests on")
 	
 	#undef OUT
 }
@@ -622,48 +1591,219 @@ static void ShowArgsAndExit(void)
 	exit(EXIT_FAILURE);
 }
 
+// moves options out of argv, leaving only the positional arguments
+static int OptionsParse(int argc, const char *argv[], struct Options *opt)
+{
+	int positional = 1;
+	
+	opt->threads = ThreadCpuCount();
+	opt->queueDepth = 4;
+	opt->level = YAZ_LEVEL_DEFAULT;
+	opt->fit = false;
+	opt->manifest = false;
+	opt->codec = 0;
+	opt->format = IMAGE_FORMAT_PNG;
+	opt->pngLevel = IMAGE_PNG_LEVEL_DEFAULT;
+	opt->pngFilter = -1;
+	opt->socket = 0;
+	
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		int *value = 0;
+		int min = 1;
+		int max = INT_MAX;
+		
+		if (!strcmp(arg, "-j"))
+			value = &opt->threads;
+		else if (!strcmp(arg, "--queue-depth"))
+			value = &opt->queueDepth;
+		else if (!strcmp(arg, "--png-level"))
+		{
+			value = &opt->pngLevel;
+			min = 0;
+			max = 9;
+		}
+		else if (!strcmp(arg, "--png-filter"))
+		{
+			value = &opt->pngFilter;
+			min = 0;
+			max = 4;
+		}
+		else if (!strcmp(arg, "--fit"))
+		{
+			opt->fit = true;
+			continue;
+		}
+		else if (!strcmp(arg, "--manifest"))
+		{
+			opt->manifest = true;
+			continue;
+		}
+		else if (!strcmp(arg, "--format"))
+		{
+			int format;
+			
+			if (i + 1 >= argc || (format = ImageFormatFind(argv[++i])) < 0)
+			{
+				fprintf(stderr, "option '%s' expects png, raw, pam, bmp, or qoi\n", arg);
+				ShowArgsAndExit();
+			}
+			opt->format = format;
+			continue;
+		}
+		else if (!strcmp(arg, "--socket"))
+		{
+			if (i + 1 >= argc)
+			{
+				fprintf(stderr, "option '%s' expects a path\n", arg);
+				ShowArgsAndExit();
+			}
+			opt->socket = argv[++i];
+			continue;
+		}
+		else if (!strcmp(arg, "--codec"))
+		{
+			if (i + 1 >= argc || !(opt->codec = CodecFindName(argv[++i])))
+			{
+				fprintf(stderr, "option '%s' expects Yaz0, Yay0, or MIO0\n", arg);
+				ShowArgsAndExit();
+			}
+			continue;
+		}
+		else if (!strcmp(arg, "--level"))
+		{
+			value = &opt->level;
+			max = YAZ_LEVEL_MAX;
+			if (i + 1 < argc && !strcmp(argv[i + 1], "max"))
+			{
+				opt->level = YAZ_LEVEL_MAX;
+				i += 1;
+				continue;
+			}
+		}
+		else if (arg[0] == '-' && arg[1])
+		{
+			fprintf(stderr, "unknown option '%s'\n", arg);
+			ShowArgsAndExit();
+		}
+		else
+		{
+			argv[positional++] = arg;
+			continue;
+		}
+		
+		if (i + 1 >= argc || sscanf(argv[++i], "%d", value) != 1 || *value < min || *value > max)
+		{
+			if (max == INT_MAX)
+				fprintf(stderr, "option '%s' expects a positive number\n", arg);
+			else
+				fprintf(stderr, "option '%s' expects a number from %d to %d\n", arg, min, max);
+			ShowArgsAndExit();
+		}
+	}
+	
+	argv[positional] = 0;
+	return positional;
+}
+
 int main(int argc, const char *argv[])
 {
-	const char *command = argv[1];
-	const char *input = argv[2];
+	struct Options opt;
+	const char *command;
+	const char *input;
+	
+	argc = OptionsParse(argc, argv, &opt);
+	command = argv[1];
+	ImageSetPngOptions(opt.pngLevel, opt.pngFilter);
+	input = argv[2];
 	
 	fprintf(stderr, "welcome to z64yartool v1.1.0 <z64.me> special thanks Javarooster\n");
 	fprintf(stderr, "build date: %s at %s\n", __DATE__, __TIME__);
 	
-	if ((!command || strcmp(command, "unyar")) && argc != 3)
+	if (!command
+		|| (strcmp(command, "unyar")
+			&& strcmp(command, "compile")
+			&& strcmp(command, "repack")
+			&& strcmp(command, "serve")
+			&& strcmp(command, "scan")
+			&& strcmp(command, "dump")
+			&& strcmp(command, "build")
+			&& strcmp(command, "verify")
+			&& argc != 3
+		)
+	)
 		ShowArgsAndExit();
 	
 	if (!strcmp(command, "stat"))
-		return YarStat(input);
+		return YarStat(input, &opt);
+	else if (!strcmp(command, "watch"))
+		return Watch(input, opt.threads, opt.level, opt.format, RetextureRebuild, &opt);
 	else if (!strcmp(command, "dump")
 		|| !strcmp(command, "build")
+		|| !strcmp(command, "verify")
 		|| !strcmp(command, "print")
 	)
 	{
-		struct Recipe *recipe = RecipeRead(input);
+		// recipes given together share one store, so a texture that
+		// appears in several archives is only written or compressed once
+		struct Store *store = StoreNew();
 		bool isDump = !strcmp(command, "dump");
+		bool isVerify = !strcmp(command, "verify");
+		int claimed;
+		int unique;
 		int rval = 0;
 		
-		if (!strcmp(command, "print"))
-		{
-			RecipePrint(recipe);
-		}
-		else if (recipe->behavior[0] == '*')
-		{
-			if (isDump)
-				rval = RetextureDump(recipe);
-			else
-				rval = RetextureBuild(recipe);
-		}
-		else
+		if (argc < 3)
+			ShowArgsAndExit();
+		
+		// verify reports on every recipe, the others stop at a failure
+		for (int i = 2; i < argc && (!rval || isVerify); ++i)
 		{
-			if (isDump)
-				rval = YarDump(recipe);
+			struct Recipe *recipe = RecipeOpen(argv[i]);
+			
+			if (!strcmp(command, "print"))
+			{
+				RecipeLoadItems(recipe);
+				RecipePrint(recipe);
+			}
+			else if (isVerify)
+			{
+				// palettes are quantized anew on every build
+				if (recipe->behavior[0] == '*')
+				{
+					fprintf(stderr, "'%s': retexture recipes can't be verified\n", argv[i]);
+					rval = EXIT_FAILURE;
+				}
+				else if (YarVerify(recipe, &opt))
+					rval = EXIT_FAILURE;
+			}
+			else if (recipe->behavior[0] == '*')
+			{
+				// retexturing needs random access to items
+				RecipeLoadItems(recipe);
+				RetextureApplyFormat(recipe, opt.format);
+				
+				if (isDump)
+					rval = RetextureDump(recipe, &opt);
+				else
+					rval = RetextureBuild(recipe, &opt);
+			}
 			else
-				rval = YarBuild(recipe);
+			{
+				if (isDump)
+					rval = YarDump(recipe, &opt, store);
+				else
+					rval = YarBuild(recipe, &opt, store);
+			}
+			
+			RecipeFree(recipe);
 		}
 		
-		RecipeFree(recipe);
+		StoreGetCounts(store, &claimed, &unique);
+		if (claimed > unique)
+			fprintf(stderr, "%d textures, %d of them unique\n", claimed, unique);
+		StoreFree(store);
 		return rval;
 	}
 	else if (!strcmp(command, "unyar"))
@@ -673,7 +1813,47 @@ int main(int argc, const char *argv[])
 		if (argc != 4)
 			ShowArgsAndExit();
 		
-		return YarUnyar(input, output);
+		return YarUnyar(input, output, opt.threads);
+	}
+	else if (!strcmp(command, "repack"))
+	{
+		const char *output = argv[3];
+		
+		if (argc != 4)
+			ShowArgsAndExit();
+		
+		return YarRepack(input, output, &opt);
+	}
+	else if (!strcmp(command, "scan"))
+	{
+		const char *output = argv[3];
+		
+		if (argc != 3 && argc != 4)
+			ShowArgsAndExit();
+		
+		return Scan(input, output, opt.threads);
+	}
+	else if (!strcmp(command, "serve"))
+	{
+		if (argc != 2 || !opt.socket)
+			ShowArgsAndExit();
+		
+		return Serve(opt.socket, opt.threads);
+	}
+	else if (!strcmp(command, "compile"))
+	{
+		const char *output = argv[3];
+		struct Recipe *recipe;
+		int rval;
+		
+		if (argc != 4)
+			ShowArgsAndExit();
+		
+		recipe = RecipeRead(input);
+		rval = RecipeCompile(recipe, output);
+		RecipeFree(recipe);
+		
+		return rval;
 	}
 	else
 	{